@@ -36,14 +36,20 @@
 
 #include "contiki.h"
 #include "orpl.h"
+#include "orpl-anycast.h"
 #include "orpl-routing-set.h"
+#include "orpl-edc-snapshot.h"
+#include "orpl-strobe-stats.h"
+#include "net/mac/csma-stats.h"
 #include "deployment.h"
 #include "tools/simple-energest.h"
 #include "net/rpl/rpl.h"
 #include "net/rpl/rpl-private.h"
 #include "net/packetbuf.h"
 #include "tools/orpl-log.h"
+#include "dev/serial-line.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 extern int forwarder_set_size;
@@ -75,14 +81,16 @@ appdataptr_from_uip()
   }
 }
 
-/* Get dataptr from the current packetbuf */
+/* Get dataptr from the current packetbuf, which may reference the
+ * packet's queuebuf while it is sent (CONTIKIMAC_CONF_WITH_ZERO_COPY) */
 struct app_data *
 appdataptr_from_packetbuf()
 {
   struct app_data *ptr;
   struct app_data data;
+  char *dataptr = packetbuf_is_reference() ? packetbuf_reference_ptr() : packetbuf_dataptr();
   if(packetbuf_datalen() < sizeof(struct app_data)) return NULL;
-  ptr = (struct app_data *)((char*)packetbuf_dataptr() + ((packetbuf_datalen() - sizeof(struct app_data))));
+  ptr = (struct app_data *)(dataptr + ((packetbuf_datalen() - sizeof(struct app_data))));
   appdata_copy(&data, ptr);
   if(data.magic == ORPL_LOG_MAGIC) {
     return ptr;
@@ -155,7 +163,16 @@ void
 orpl_log_print_neighbor_list()
 {
 #if WITH_ORPL
+  rpl_parent_t *p;
   orpl_calculate_edc(1);
+  /* Estimated cost of routing down to every neighbor below us */
+  for(p = nbr_table_head(rpl_parents); p != NULL; p = nbr_table_next(rpl_parents, p)) {
+    if(p->rank != 0xffff && p->rank > orpl_current_edc()) {
+      ORPL_LOG("ORPL: downward edc to %u (edc %u): %u\n",
+          node_id_from_rimeaddr(nbr_table_get_lladdr(rpl_parents, p)),
+          p->rank, orpl_downward_edc(p->rank));
+    }
+  }
 #else
   rpl_print_neighbor_list();
 #endif
@@ -203,6 +220,150 @@ orpl_log_print_routing_set()
   ORPL_LOG("\nRouting set list: end (%u nodes)\n",count);
 }
 
+#if WITH_ORPL
+/* Print a snapshot field, in little-endian hex */
+static void
+log_snapshot_field(uint32_t value, int len)
+{
+  while(len-- > 0) {
+    ORPL_LOG("%02x", (unsigned)(value & 0xff));
+    value >>= 8;
+  }
+}
+#endif /* WITH_ORPL */
+
+/* Dumps a snapshot of the inputs of the EDC computation (see orpl-edc-snapshot.h),
+ * as a single hex line that can be replayed offline with tools/edc-replay */
+void
+orpl_log_edc_snapshot()
+{
+#if WITH_ORPL
+  rpl_parent_t *p;
+  int count = 0;
+
+  for(p = nbr_table_head(rpl_parents);
+      p != NULL && count < ORPL_EDC_SNAPSHOT_MAX_NBR;
+      p = nbr_table_next(rpl_parents, p)) {
+    count++;
+  }
+
+  ORPL_LOG("ORPL: edc snapshot ");
+  log_snapshot_field(ORPL_EDC_SNAPSHOT_VERSION, 1);
+  log_snapshot_field(node_id, 2);
+  /* The unfiltered EDC, as computed from the snapshot's inputs */
+  log_snapshot_field(orpl_calculate_edc(0), 2);
+  log_snapshot_field(orpl_hbh_edc(direction_up), 2);
+  log_snapshot_field(orpl_edc_w(), 2);
+  log_snapshot_field(orpl_broadcast_count, 4);
+  log_snapshot_field(count, 1);
+  for(p = nbr_table_head(rpl_parents);
+      p != NULL && count > 0;
+      p = nbr_table_next(rpl_parents, p), count--) {
+    log_snapshot_field(node_id_from_rimeaddr(nbr_table_get_lladdr(rpl_parents, p)), 2);
+    log_snapshot_field(p->rank, 2);
+    log_snapshot_field(p->bc_ackcount, 2);
+  }
+  ORPL_LOG("\n");
+#endif /* WITH_ORPL */
+}
+
+#if WITH_ORPL && ORPL_WITH_STROBE_STATS
+/* Converts rtimer ticks to ms, without overflowing */
+static unsigned long
+ticks_to_ms(uint32_t ticks)
+{
+  return (ticks / RTIMER_ARCH_SECOND) * 1000
+      + (ticks % RTIMER_ARCH_SECOND) * 1000 / RTIMER_ARCH_SECOND;
+}
+
+/* Print one strobe statistics record, times in ms */
+static void
+log_strobe_stats_record(const struct orpl_strobe_stats *s)
+{
+  ORPL_LOG("tx %u ack %u col %u strobes %u time %lu lat %lu\n",
+      s->tx_count, s->ack_count, s->collision_count, s->strobe_count,
+      ticks_to_ms(s->strobe_time), ticks_to_ms(s->ack_latency));
+}
+#endif /* WITH_ORPL && ORPL_WITH_STROBE_STATS */
+
+/* Prints strobe statistics since the last call, one record per traffic class
+ * and per neighbor that acked us, and resets them */
+void
+orpl_log_strobe_stats()
+{
+#if WITH_ORPL && ORPL_WITH_STROBE_STATS
+  int i;
+  struct orpl_strobe_stats *s;
+
+  for(i = 0; i < ORPL_STROBE_STATS_CLASSES; i++) {
+    const struct orpl_strobe_stats *cs = orpl_strobe_stats_class(i);
+    if(cs->tx_count > 0) {
+      ORPL_LOG("ORPL: strobe class %s ", orpl_strobe_stats_class_name(i));
+      log_strobe_stats_record(cs);
+    }
+  }
+  for(s = nbr_table_head(orpl_strobe_stats_nbr); s != NULL;
+      s = nbr_table_next(orpl_strobe_stats_nbr, s)) {
+    if(s->tx_count > 0) {
+      ORPL_LOG("ORPL: strobe node %u ",
+          node_id_from_rimeaddr(nbr_table_get_lladdr(orpl_strobe_stats_nbr, s)));
+      log_strobe_stats_record(s);
+    }
+  }
+  orpl_strobe_stats_reset();
+#endif /* WITH_ORPL && ORPL_WITH_STROBE_STATS */
+}
+
+/* Prints CSMA pool occupancy, high-water marks and allocation failures
+ * since the last call, and resets them */
+void
+orpl_log_csma_stats()
+{
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+  int i;
+  const struct csma_stats *s = csma_stats();
+
+  ORPL_LOG("ORPL: csma nbr %u/%u/%u fail %u pkt %u/%u/%u fail %u shared %u/%u qbuf fail %u\n",
+      s->neighbors.used, s->neighbors.high_water, s->neighbors.borrowed,
+      s->neighbors.alloc_failures,
+      s->packets.used, s->packets.high_water, s->packets.borrowed,
+      s->packets.alloc_failures,
+      s->shared.used, s->shared.high_water, s->queuebuf_failures);
+  ORPL_LOG("ORPL: csma queued");
+  for(i = 0; i < CSMA_STATS_DIRECTIONS; i++) {
+    ORPL_LOG(" %u/%u", s->queued[i], s->queued_high_water[i]);
+  }
+  ORPL_LOG("\n");
+  csma_stats_reset();
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+}
+
+/* Handle a command received over the serial line. Supported commands:
+ * "edc_w" prints the current EDC_W, "edc_w <w>" sets it.
+ * "edc_snapshot" dumps a snapshot of the EDC computation inputs. */
+static void
+orpl_log_command(const char *cmd)
+{
+#if WITH_ORPL
+  if(!strncmp(cmd, "edc_w", 5)) {
+    if(cmd[5] == ' ') {
+      char *end;
+      long w = strtol(cmd + 6, &end, 10);
+      if(end == cmd + 6 || *end != '\0'
+          || w < ORPL_EDC_W_MIN || w > ORPL_EDC_W_MAX) {
+        ORPL_LOG("ORPL: bad edc_w %s, expected %u..%u\n",
+            cmd + 6, ORPL_EDC_W_MIN, ORPL_EDC_W_MAX);
+        return;
+      }
+      orpl_set_edc_w(w);
+    }
+    ORPL_LOG("ORPL: edc_w %u\n", orpl_edc_w());
+  } else if(!strcmp(cmd, "edc_snapshot")) {
+    orpl_log_edc_snapshot();
+  }
+#endif /* WITH_ORPL */
+}
+
 PROCESS(orpl_log_process, "ORPL Log");
 
 /* Starts logging process */
@@ -223,7 +384,11 @@ PROCESS_THREAD(orpl_log_process, ev, data)
     static int cnt = 0;
     neighbor_set_size = uip_ds6_nbr_num();
 
-    PROCESS_WAIT_UNTIL(etimer_expired(&periodic));
+    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&periodic) || ev == serial_line_event_message);
+    if(ev == serial_line_event_message && data != NULL) {
+      orpl_log_command((const char *)data);
+      continue;
+    }
     etimer_reset(&periodic);
     simple_energest_step();
 
@@ -231,6 +396,14 @@ PROCESS_THREAD(orpl_log_process, ev, data)
     ORPL_LOG_PRINT_NEIGHBOR_LIST();
 
 #if WITH_ORPL
+    ORPL_LOG("ORPL: edc_w %u\n", orpl_edc_w());
+
+    /* Periodic strobe statistics */
+    orpl_log_strobe_stats();
+
+    /* Periodic CSMA pool statistics */
+    orpl_log_csma_stats();
+
     /* Periodic debugging of ORPL routing sets */
     if(orpl_are_routing_set_active() && ++cnt % 8 == 0) {
       orpl_log_print_routing_set();
@@ -66,6 +66,12 @@ uint16_t log_node_id_from_rimeaddr(const void *rimeaddr);
 uint16_t log_node_id_from_ipaddr(const void *ipaddr);
 /* Prints out the content of the active routing set */
 void orpl_log_print_routing_set();
+/* Dumps a snapshot of the inputs of the EDC computation, for offline replay */
+void orpl_log_edc_snapshot();
+/* Prints and resets the strobe statistics, per traffic class and per neighbor */
+void orpl_log_strobe_stats();
+/* Prints and resets the CSMA pool statistics */
+void orpl_log_csma_stats();
 /* Starts logging process */
 void orpl_log_start();
 
@@ -78,6 +84,7 @@ void orpl_log_start();
 #define ORPL_LOG_LLADDR(addr) uip_debug_lladdr_print(addr)
 #define ORPL_LOG_INC_HOPCOUNT_FROM_PACKETBUF() { struct app_data *ptr = appdataptr_from_packetbuf(); if(ptr) ptr->hop++; }
 #define ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF() { struct app_data *ptr = appdataptr_from_packetbuf(); if(ptr) ptr->fpcount++; }
+#define ORPL_LOG_INC_FPCOUNT_FROM_UIP() { struct app_data *ptr = appdataptr_from_uip(); if(ptr) ptr->fpcount++; }
 #define ORPL_LOG_PRINT_NEIGHBOR_LIST() orpl_log_print_neighbor_list()
 
 #define ORPL_LOG_NODEID_FROM_RIMEADDR log_node_id_from_rimeaddr
@@ -151,6 +151,9 @@ int cc2420_off(void);
 static int cc2420_read(void *buf, unsigned short bufsize);
 
 static int cc2420_prepare(const void *data, unsigned short len);
+static int cc2420_prepare_padded(const void *hdr, unsigned short hdr_len,
+                                 const void *data, unsigned short len,
+                                 unsigned short padded_len);
 static int cc2420_transmit(unsigned short len);
 static int cc2420_send(const void *data, unsigned short len);
 
@@ -455,13 +458,28 @@ cc2420_transmit(unsigned short payload_len)
 static int
 cc2420_prepare(const void *payload, unsigned short payload_len)
 {
+  return cc2420_prepare_padded(NULL, 0, payload, payload_len, payload_len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+cc2420_prepare_padded(const void *hdr, unsigned short hdr_len,
+                      const void *payload, unsigned short payload_len,
+                      unsigned short padded_len)
+{
+  static const uint8_t zeroes[16];
+  unsigned short len;
+  uint8_t chunk;
   uint8_t total_len;
 #if CC2420_CONF_CHECKSUM
   uint16_t checksum;
 #endif /* CC2420_CONF_CHECKSUM */
   GET_LOCK();
 
-  PRINTF("cc2420: sending %d bytes\n", payload_len);
+  if(padded_len < hdr_len + payload_len) {
+    padded_len = hdr_len + payload_len;
+  }
+
+  PRINTF("cc2420: sending %d bytes (%d padded)\n", hdr_len + payload_len, padded_len);
 
   RIMESTATS_ADD(lltx);
 
@@ -472,11 +490,23 @@ cc2420_prepare(const void *payload, unsigned short payload_len)
   strobe(CC2420_SFLUSHTX);
 
 #if CC2420_CONF_CHECKSUM
-  checksum = crc16_data(payload, payload_len, 0);
+  checksum = crc16_data(hdr, hdr_len, 0);
+  checksum = crc16_data(payload, payload_len, checksum);
+  for(len = hdr_len + payload_len; len < padded_len; len++) {
+    checksum = crc16_add(0, checksum);
+  }
 #endif /* CC2420_CONF_CHECKSUM */
-  total_len = payload_len + AUX_LEN;
+  total_len = padded_len + AUX_LEN;
   CC2420_WRITE_FIFO_BUF(&total_len, 1);
+  if(hdr_len > 0) {
+    CC2420_WRITE_FIFO_BUF(hdr, hdr_len);
+  }
   CC2420_WRITE_FIFO_BUF(payload, payload_len);
+  /* Padding goes straight to the FIFO, it never needs to be in memory */
+  for(len = hdr_len + payload_len; len < padded_len; len += chunk) {
+    chunk = padded_len - len < sizeof(zeroes) ? padded_len - len : sizeof(zeroes);
+    CC2420_WRITE_FIFO_BUF(zeroes, chunk);
+  }
 #if CC2420_CONF_CHECKSUM
   CC2420_WRITE_FIFO_BUF(&checksum, CHECKSUM_LEN);
 #endif /* CC2420_CONF_CHECKSUM */
@@ -648,6 +678,11 @@ cc2420_softack_subscribe(softack_input_callback_f *input_callback, softack_acked
   softack_acked_callback = acked_callback;
 }
 
+const struct softack_driver cc2420_softack = {
+  cc2420_softack_subscribe,
+  cc2420_prepare_padded
+};
+
 int
 cc2420_interrupt(void)
 {
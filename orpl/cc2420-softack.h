@@ -41,11 +41,12 @@
 #define __CC2420_SOFTACK_H__
 
 #include "dev/cc2420.h"
-
-typedef void(softack_input_callback_f)(const uint8_t *frame, uint8_t framelen, uint8_t **ackbufptr, uint8_t *acklen);
-typedef void(softack_acked_callback_f)(const uint8_t *frame, uint8_t framelen);
+#include "softack.h"
 
 /* Subscribe with two callbacks called from FIFOP interrupt */
 void cc2420_softack_subscribe(softack_input_callback_f *input_callback, softack_acked_callback_f *acked_callback);
 
+/* Softack driver, to be used along with cc2420_softack_driver */
+extern const struct softack_driver cc2420_softack;
+
 #endif /* __CC2420_SOFTACK_H__ */
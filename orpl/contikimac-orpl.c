@@ -45,20 +45,27 @@
 #include "dev/watchdog.h"
 #include "lib/random.h"
 #include "net/mac/contikimac.h"
+#include "net/mac/frame802154.h"
 #include "net/netstack.h"
+#include "net/queuebuf.h"
 #include "net/rime.h"
 #include "sys/compower.h"
 #include "sys/pt.h"
 #include "sys/rtimer.h"
 #include "orpl.h"
 #include "orpl-anycast.h"
+#include "softack.h"
+#if ORPL_WITH_STROBE_STATS
+#include "orpl-strobe-stats.h"
+#endif /* ORPL_WITH_STROBE_STATS */
 
 #include <string.h>
 
 #if WITH_ORPL
 
-/* We add a jitter in the ContikiMAC wakeups to avoid having the same collisions repeatedly */
-#define WITH_CONTIKIMIAC_JITTER 1
+/* We add a jitter in the ContikiMAC wakeups to avoid having the same collisions repeatedly.
+ * Not with the phase tracker, which requires wake-ups at a fixed period. */
+#define WITH_CONTIKIMIAC_JITTER (!ORPL_WITH_PHASE_TRACKER)
 
 /* TX/RX cycles are synchronized with neighbor wake periods */
 #ifdef CONTIKIMAC_CONF_WITH_PHASE_OPTIMIZATION
@@ -73,6 +80,39 @@
 #else
 #define WITH_CONTIKIMAC_HEADER       1
 #endif
+/* Pad short frames while writing them to the radio (see struct
+   softack_driver) rather than in packetbuf, saving a memset and the
+   copy of the padding at every transmission attempt */
+#ifdef CONTIKIMAC_CONF_WITH_RADIO_PADDING
+#define WITH_RADIO_PADDING           CONTIKIMAC_CONF_WITH_RADIO_PADDING
+#else
+#define WITH_RADIO_PADDING           0
+#endif
+/* Transmit from the queuebuf the packet is queued in, referenced rather than
+   copied into packetbuf at every transmission attempt. Only the MAC headers
+   are built in packetbuf, the radio gathers them with the payload.
+   Requires ORPL's reference-counted queuebuf: build with WITH_ZERO_COPY=1. */
+#ifdef CONTIKIMAC_CONF_WITH_ZERO_COPY
+#define WITH_ZERO_COPY               CONTIKIMAC_CONF_WITH_ZERO_COPY
+#else
+#define WITH_ZERO_COPY               0
+#endif
+#if WITH_ZERO_COPY && !WITH_RADIO_PADDING
+#error "CONTIKIMAC_CONF_WITH_ZERO_COPY requires CONTIKIMAC_CONF_WITH_RADIO_PADDING"
+#endif
+#if WITH_ZERO_COPY && !defined(QUEUEBUF_WITH_REFCOUNT)
+#error "CONTIKIMAC_CONF_WITH_ZERO_COPY requires ORPL's queuebuf, build with WITH_ZERO_COPY=1"
+#endif
+#if WITH_ZERO_COPY && defined(NETSTACK_ENCRYPT)
+#error "CONTIKIMAC_CONF_WITH_ZERO_COPY does not support NETSTACK_ENCRYPT"
+#endif
+/* Detect short frames with more closely spaced CCAs instead of padding
+   every frame to 125 bytes (see CCA_SLEEP_TIME and SHORTEST_PACKET_SIZE) */
+#ifdef CONTIKIMAC_CONF_WITH_SHORT_FRAMES
+#define WITH_SHORT_FRAMES            CONTIKIMAC_CONF_WITH_SHORT_FRAMES
+#else
+#define WITH_SHORT_FRAMES            0
+#endif
 /* More aggressive radio sleeping when channel is busy with other traffic */
 #ifndef WITH_FAST_SLEEP
 #define WITH_FAST_SLEEP              1
@@ -101,7 +141,30 @@
 struct hdr {
   uint8_t id;
   uint8_t len;
+#if ORPL_WITH_TX_BUDGET
+  /* ORPL transmission budget left, this transmission included */
+  uint8_t budget;
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+  /* ORPL packet priority */
+  uint8_t priority;
+  /* Time left before the ORPL deadline, in clock ticks, big endian.
+     0 for no deadline. */
+  uint8_t lifetime[2];
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+#if ORPL_WITH_BURST
+  /* Forwarder that acked the first frame of the burst, the only one
+     allowed to ack this frame. rimeaddr_null for any forwarder.
+     Must remain last, see orpl-anycast.c */
+  rimeaddr_t burst_receiver;
+#endif /* ORPL_WITH_BURST */
 };
+#elif ORPL_WITH_BURST
+#error ORPL_WITH_BURST requires CONTIKIMAC_CONF_WITH_CONTIKIMAC_HEADER
+#elif ORPL_WITH_TX_BUDGET
+#error ORPL_WITH_TX_BUDGET requires CONTIKIMAC_CONF_WITH_CONTIKIMAC_HEADER
+#elif ORPL_WITH_PRIORITY_QUEUEING
+#error ORPL_WITH_PRIORITY_QUEUEING requires CONTIKIMAC_CONF_WITH_CONTIKIMAC_HEADER
 #endif /* WITH_CONTIKIMAC_HEADER */
 
 /* CYCLE_TIME for channel cca checks, in rtimer ticks. */
@@ -118,13 +181,18 @@ struct hdr {
  * do not have the same truncation error.
  * Define SYNC_CYCLE_STARTS to ensure an integral number of checks per second.
  */
-#if RTIMER_ARCH_SECOND & (RTIMER_ARCH_SECOND - 1)
+#if (RTIMER_ARCH_SECOND & (RTIMER_ARCH_SECOND - 1)) && !ORPL_WITH_ADAPTIVE_CYCLE
 #define SYNC_CYCLE_STARTS                    1
 #endif
 
 /* Are we currently receiving a burst? */
 static int we_are_receiving_burst = 0;
 
+#if ORPL_WITH_BURST
+/* Forwarder that acked the first frame of the burst we are sending */
+static rimeaddr_t burst_receiver;
+#endif /* ORPL_WITH_BURST */
+
 /* INTER_PACKET_DEADLINE is the maximum time a receiver waits for the
    next packet of a burst when FRAME_PENDING is set. */
 #define INTER_PACKET_DEADLINE               CLOCK_SECOND / 32
@@ -132,9 +200,13 @@ static int we_are_receiving_burst = 0;
 /* ContikiMAC performs periodic channel checks. Each channel check
    consists of two or more CCA checks. CCA_COUNT_MAX is the number of
    CCAs to be done for each periodic channel check. The default is
-   two.*/
+   two. With WITH_SHORT_FRAMES, CCAs are closer to each other, and we
+   do as many as needed to span the longest silence between two strobed
+   frames. */
 #ifdef CONTIKIMAC_CONF_CCA_COUNT_MAX
 #define CCA_COUNT_MAX                      (CONTIKIMAC_CONF_CCA_COUNT_MAX)
+#elif WITH_SHORT_FRAMES
+#define CCA_COUNT_MAX                      (STROBE_SILENCE_TIME / (CCA_CHECK_TIME + CCA_SLEEP_TIME) + 2)
 #else
 #define CCA_COUNT_MAX                      2
 #endif
@@ -155,17 +227,34 @@ static int we_are_receiving_burst = 0;
 #define CCA_CHECK_TIME                     RTIMER_ARCH_SECOND / 8192
 #endif
 
+/* STROBE_SILENCE_TIME is the longest silence between two frames of a
+   strobe, i.e. the inter-packet interval that results from ORPL's acked
+   broadcasts. Two CCAs must never both fall within it (checked against
+   CCA_COUNT_MAX and SHORTEST_PACKET_SIZE below). */
+#define STROBE_SILENCE_TIME                (RTIMER_ARCH_SECOND / 600)
+
+/* FRAME_AIRTIME is the time it takes to transmit a frame of len bytes
+   at 250 kbps, including the 6 bytes of preamble, SFD and length. No
+   cast, so that it can be used in #if. */
+#define FRAME_AIRTIME(len)                 ((((len) + 6UL) * RTIMER_ARCH_SECOND) / 31250)
+
 /* CCA_SLEEP_TIME is the time between two successive CCA checks. */
 /* Add 1 when rtimer ticks are coarse */
-#if RTIMER_ARCH_SECOND > 8000
+#if WITH_SHORT_FRAMES
+/* Space CCAs such that no frame of SHORTEST_PACKET_SIZE bytes can fit
+   between two of them. This costs one more CCA per channel check (three
+   instead of two with 42-byte frames), but spares the airtime of padding
+   every frame to 125 bytes at every strobe. */
+#define CCA_SLEEP_TIME                     (FRAME_AIRTIME(SHORTEST_PACKET_SIZE) - CCA_CHECK_TIME - 1)
+#elif RTIMER_ARCH_SECOND > 8000
 //#define CCA_SLEEP_TIME                     RTIMER_ARCH_SECOND / 2000
 /* Increase standard ContikiMAC inter-cca period, to accomodate for longer
  * inter-packet interval that result from ORPL's acked broadcasts.
  * Given the minimum size of ORPL frames (42 bytes), this interval still
  * guarantees no packet will be missed. */
-#define CCA_SLEEP_TIME                     RTIMER_ARCH_SECOND / 600
+#define CCA_SLEEP_TIME                     STROBE_SILENCE_TIME
 #else
-#define CCA_SLEEP_TIME                     (RTIMER_ARCH_SECOND / 600) + 1
+#define CCA_SLEEP_TIME                     STROBE_SILENCE_TIME + 1
 #endif
 
 /* CHECK_TIME is the total time it takes to perform CCA_COUNT_MAX
@@ -221,6 +310,70 @@ static int we_are_receiving_burst = 0;
    to a neighbor for which we have a phase lock. */
 #define MAX_PHASE_STROBE_TIME              RTIMER_ARCH_SECOND / 60
 
+#if ORPL_WITH_SFD_ACK_DETECTION
+/* ACK_START_TIMEOUT is the time after a transmission within which the
+   SFD of the ACK must have been detected. Otherwise, we retransmit.
+   ORPL ACKs are software ACKs, built by the receiver in its FIFOP
+   interrupt once it has read the frame header (cc2420-softack.c). They
+   start well after the 22 symbols (352 us) of a hardware ACK turnaround,
+   so the timeout keeps the margin of INTER_PACKET_INTERVAL. A shorter
+   timeout makes us retransmit over ACKs, i.e. false NOACKs. */
+#ifdef CONTIKIMAC_CONF_ACK_START_TIMEOUT
+#define ACK_START_TIMEOUT                  CONTIKIMAC_CONF_ACK_START_TIMEOUT
+#else
+#define ACK_START_TIMEOUT                  INTER_PACKET_INTERVAL
+#endif
+/* ACK_RECEIVE_TIMEOUT is the maximum time between the SFD of the ACK
+   and the ACK being available in the radio FIFO. */
+#define ACK_RECEIVE_TIMEOUT                AFTER_ACK_DETECTECT_WAIT_TIME
+#endif /* ORPL_WITH_SFD_ACK_DETECTION */
+
+#if ORPL_WITH_COLLISION_RESCHEDULE
+/* MAX_FOREIGN_FRAME_TIME is the maximum time we wait for foreign traffic
+   to end before transmitting, i.e. the duration of a maximum-size frame. */
+#define MAX_FOREIGN_FRAME_TIME             RTIMER_ARCH_SECOND / 200
+/* CCA_MAX_RESCHEDULES is the number of times we wait for foreign traffic
+   to end and restart the CCA checks, before reporting a collision. */
+#define CCA_MAX_RESCHEDULES                3
+#endif /* ORPL_WITH_COLLISION_RESCHEDULE */
+
+#if ORPL_WITH_ADAPTIVE_CYCLE
+/* ADAPTIVE_CYCLE_LEVELS is the number of channel check levels. At level l,
+   the cycle time is CYCLE_TIME >> l. CYCLE_TIME is the slowest level, as
+   strobes must remain shorter than half the rtimer range. */
+#define ADAPTIVE_CYCLE_LEVELS              4
+#define LEVEL_CYCLE_TIME(level)            (CYCLE_TIME >> (level))
+#define CURRENT_CYCLE_TIME                 LEVEL_CYCLE_TIME(contikimac_cycle_level)
+/* ADAPTIVE_CYCLE_PERIOD is the period at which we update our level */
+#define ADAPTIVE_CYCLE_PERIOD              (60 * CLOCK_SECOND)
+/* We speed up when more than one wake-up in ADAPTIVE_CYCLE_HIGH receives
+   a frame, and slow down when less than one in ADAPTIVE_CYCLE_LOW does */
+#define ADAPTIVE_CYCLE_HIGH                8
+#define ADAPTIVE_CYCLE_LOW                 64
+#else /* ORPL_WITH_ADAPTIVE_CYCLE */
+#define CURRENT_CYCLE_TIME                 CYCLE_TIME
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
+#if ORPL_WITH_RI_PROBES
+/* RI_PROBE_INTERVAL is the interval between two probes of a node whose
+   radio is always on */
+#define RI_PROBE_INTERVAL                  (CLOCK_SECOND / 16)
+/* RI_PROBE_WAIT is the maximum time a sender listens for a probe. It
+   never exceeds the cycle, i.e. the strobe that the probe saves. */
+#define RI_PROBE_WAIT_MAX                  (RTIMER_ARCH_SECOND / 16 + RTIMER_ARCH_SECOND / 200)
+#define RI_PROBE_WAIT                      (RI_PROBE_WAIT_MAX < CYCLE_TIME ? RI_PROBE_WAIT_MAX : CYCLE_TIME)
+/* RI_PROBE_SEND_WAIT is the maximum time a wake-up waits for its probe
+   to be sent from process context, before a regular channel check */
+#define RI_PROBE_SEND_WAIT                 (RTIMER_ARCH_SECOND / 250)
+/* RI_PROBER_TIMEOUT is the time after the last probe heard from a forwarder
+   during which we keep listening for probes before strobing */
+#define RI_PROBER_TIMEOUT                  (60 * CLOCK_SECOND)
+/* Return values of ri_probe_wait */
+#define RI_PROBE_NONE                      0
+#define RI_PROBE_HEARD                     1
+#define RI_PROBE_RX                        2
+#endif /* ORPL_WITH_RI_PROBES */
+
 
 /* SHORTEST_PACKET_SIZE is the shortest packet that ContikiMAC
    allows. Packets have to be a certain size to be able to be detected
@@ -231,10 +384,24 @@ static int we_are_receiving_burst = 0;
    With no header, reduce to transmit a proper multicast RPL DIS. */
 #ifdef CONTIKIMAC_CONF_SHORTEST_PACKET_SIZE
 #define SHORTEST_PACKET_SIZE  CONTIKIMAC_CONF_SHORTEST_PACKET_SIZE
+#elif WITH_SHORT_FRAMES
+/* The minimum size of ORPL frames, detected thanks to closer CCAs */
+#define SHORTEST_PACKET_SIZE               42
 #else
 #define SHORTEST_PACKET_SIZE               125
 #endif
 
+/* Channel checks detect strobes only if a SHORTEST_PACKET_SIZE frame
+   cannot fit between two CCAs, and if the CCA_COUNT_MAX CCAs cannot all
+   fall within the STROBE_SILENCE_TIME between two frames. Catch settings
+   that break either at compile time. */
+#if FRAME_AIRTIME(SHORTEST_PACKET_SIZE) <= (CCA_SLEEP_TIME)
+#error "contikimac: SHORTEST_PACKET_SIZE frames fit between two CCAs"
+#endif
+#if (CCA_COUNT_MAX - 1) * (CCA_CHECK_TIME + CCA_SLEEP_TIME) <= STROBE_SILENCE_TIME
+#error "contikimac: CCA_COUNT_MAX CCAs do not span STROBE_SILENCE_TIME"
+#endif
+
 
 #define ACK_LEN 3 + EXTRA_ACK_LEN
 
@@ -244,6 +411,21 @@ static struct pt pt;
 
 static volatile uint8_t contikimac_is_on = 0;
 volatile uint8_t contikimac_keep_radio_on = 0;
+#if ORPL_WITH_ADAPTIVE_CYCLE
+volatile uint8_t contikimac_cycle_level = 0;
+/* Wake-ups and received frames during the current ADAPTIVE_CYCLE_PERIOD */
+static uint16_t adaptive_wakeup_count;
+static uint16_t adaptive_rx_count;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+#if ORPL_WITH_RI_PROBES && ORPL_WITH_ADAPTIVE_CYCLE
+/* Wake-up probes are sent by ri_probe_process on behalf of the
+   powercycle, as the radio must not be used from interrupt */
+PROCESS(ri_probe_process, "ContikiMAC RI probes");
+/* Set while the powercycle waits for a wake-up probe */
+static volatile uint8_t ri_probe_requested;
+/* Set once the wake-up probe is sent */
+static volatile uint8_t ri_probe_sent;
+#endif /* ORPL_WITH_RI_PROBES && ORPL_WITH_ADAPTIVE_CYCLE */
 
 volatile unsigned char we_are_sending = 0;
 static volatile unsigned char radio_is_on = 0;
@@ -279,21 +461,32 @@ struct seqno {
   uint8_t seqno;
 };
 
-struct app_seqno {
-  uint32_t seqno;
-};
-
 #ifdef NETSTACK_CONF_MAC_SEQNO_HISTORY
 #define MAX_SEQNOS_LL NETSTACK_CONF_MAC_SEQNO_HISTORY
 #else /* NETSTACK_CONF_MAC_SEQNO_HISTORY */
 #define MAX_SEQNOS_LL 16
 #endif /* NETSTACK_CONF_MAC_SEQNO_HISTORY */
 static struct seqno received_seqnos[MAX_SEQNOS_LL];
-/* App-layer duplicate detection. Done at RDC layer for simplicity. */
-#define MAX_SEQNOS_APP 32
-static struct app_seqno received_app_seqnos[MAX_SEQNOS_APP];
 
-#if CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT
+#if ORPL_WITH_BROADCAST_CLASSES
+/* Token bucket of a broadcast class, see ORPL_WITH_BROADCAST_CLASSES */
+struct broadcast_bucket {
+  uint8_t budget;
+  uint8_t priority;
+  clock_time_t interval;
+  uint8_t tokens;
+  clock_time_t last_refill;
+};
+/* One bucket per enum broadcast_class_e, all initially full */
+static struct broadcast_bucket broadcast_buckets[ORPL_BROADCAST_CLASSES] = {
+  { ORPL_BROADCAST_APP_BUDGET, ORPL_BROADCAST_APP_PRIORITY,
+    ORPL_BROADCAST_APP_INTERVAL, ORPL_BROADCAST_APP_BUDGET, 0 },
+  { ORPL_BROADCAST_RPL_BUDGET, ORPL_BROADCAST_RPL_PRIORITY,
+    ORPL_BROADCAST_RPL_INTERVAL, ORPL_BROADCAST_RPL_BUDGET, 0 },
+  { ORPL_BROADCAST_ROUTING_SET_BUDGET, ORPL_BROADCAST_ROUTING_SET_PRIORITY,
+    ORPL_BROADCAST_ROUTING_SET_INTERVAL, ORPL_BROADCAST_ROUTING_SET_BUDGET, 0 },
+};
+#elif CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT
 static struct timer broadcast_rate_timer;
 static int broadcast_rate_counter;
 #endif /* CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT */
@@ -419,12 +612,34 @@ powercycle(struct rtimer *t, void *ptr)
 #endif
     }
 #else
-    cycle_start += CYCLE_TIME;
+    cycle_start += CURRENT_CYCLE_TIME;
 #endif
 
+#if ORPL_WITH_ADAPTIVE_CYCLE
+    adaptive_wakeup_count++;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
     packet_seen = 0;
 
-    for(count = 0; count < CCA_COUNT_MAX; ++count) {
+#if ORPL_WITH_RI_PROBES && ORPL_WITH_ADAPTIVE_CYCLE
+    if(contikimac_cycle_level == ADAPTIVE_CYCLE_LEVELS - 1 &&
+       we_are_sending == 0 && we_are_receiving_burst == 0) {
+      /* We are heavily loaded: announce our wake-up with a probe, and
+         listen as if a packet had been seen. The probe is sent from
+         process context. If it did not go out within RI_PROBE_SEND_WAIT,
+         e.g. the radio was busy, fall back to a regular channel check. */
+      powercycle_turn_radio_on();
+      ri_probe_sent = 0;
+      ri_probe_requested = 1;
+      process_poll(&ri_probe_process);
+      schedule_powercycle_fixed(t, RTIMER_NOW() + RI_PROBE_SEND_WAIT);
+      PT_YIELD(&pt);
+      ri_probe_requested = 0;
+      packet_seen = ri_probe_sent;
+    }
+#endif /* ORPL_WITH_RI_PROBES && ORPL_WITH_ADAPTIVE_CYCLE */
+
+    for(count = 0; !packet_seen && count < CCA_COUNT_MAX; ++count) {
       t0 = RTIMER_NOW();
       if(we_are_sending == 0 && we_are_receiving_burst == 0) {
         powercycle_turn_radio_on();
@@ -503,7 +718,7 @@ powercycle(struct rtimer *t, void *ptr)
       }
     }
 
-    if(RTIMER_CLOCK_LT(RTIMER_NOW() - cycle_start, CYCLE_TIME - CHECK_TIME * 4)) {
+    if(RTIMER_CLOCK_LT(RTIMER_NOW() - cycle_start, CURRENT_CYCLE_TIME - CHECK_TIME * 4)) {
       /* Schedule the next powercycle interrupt, or sleep the mcu
 	 until then.  Sleeping will not exit from this interrupt, so
 	 ensure an occasional wake cycle or foreground processing will
@@ -511,18 +726,18 @@ powercycle(struct rtimer *t, void *ptr)
 #if RDC_CONF_MCU_SLEEP
       static uint8_t sleepcycle;
       if((sleepcycle++ < 16) && !we_are_sending && !radio_is_on) {
-        rtimer_arch_sleep(CYCLE_TIME - (RTIMER_NOW() - cycle_start));
+        rtimer_arch_sleep(CURRENT_CYCLE_TIME - (RTIMER_NOW() - cycle_start));
       } else {
         sleepcycle = 0;
-        schedule_powercycle_fixed(t, CYCLE_TIME + cycle_start);
+        schedule_powercycle_fixed(t, CURRENT_CYCLE_TIME + cycle_start);
         PT_YIELD(&pt);
       }
 #else
 
 #if WITH_CONTIKIMIAC_JITTER
-      schedule_powercycle(t, CYCLE_TIME - (random_rand() % (CYCLE_TIME/8)));
+      schedule_powercycle(t, CURRENT_CYCLE_TIME - (random_rand() % (CURRENT_CYCLE_TIME/8)));
 #else
-      schedule_powercycle_fixed(t, CYCLE_TIME + cycle_start);
+      schedule_powercycle_fixed(t, CURRENT_CYCLE_TIME + cycle_start);
 #endif
       PT_YIELD(&pt);
 #endif
@@ -532,10 +747,60 @@ powercycle(struct rtimer *t, void *ptr)
   PT_END(&pt);
 }
 /*---------------------------------------------------------------------------*/
+#if ORPL_WITH_BROADCAST_CLASSES
+/* Add the tokens earned since the last refill */
+static void
+broadcast_bucket_refill(struct broadcast_bucket *b)
+{
+  clock_time_t now = clock_time();
+  while(b->tokens < b->budget && now - b->last_refill >= b->interval) {
+    b->tokens++;
+    b->last_refill += b->interval;
+  }
+  if(b->tokens == b->budget) {
+    /* A full bucket does not accumulate credit */
+    b->last_refill = now;
+  }
+}
+#endif /* ORPL_WITH_BROADCAST_CLASSES */
+/*---------------------------------------------------------------------------*/
 static int
 broadcast_rate_drop(void)
 {
-#if CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT
+#if ORPL_WITH_BROADCAST_CLASSES
+  uint8_t class = packetbuf_attr(PACKETBUF_ATTR_ORPL_BROADCAST_CLASS);
+  struct broadcast_bucket *b = NULL;
+  int i;
+
+  if(class >= ORPL_BROADCAST_CLASSES) {
+    class = broadcast_class_app;
+  }
+  for(i = 0; i < ORPL_BROADCAST_CLASSES; i++) {
+    broadcast_bucket_refill(&broadcast_buckets[i]);
+  }
+
+  if(broadcast_buckets[class].tokens > 0) {
+    b = &broadcast_buckets[class];
+  } else {
+    /* Out of budget: take a token from the lowest-priority class that
+     * ranks below ours. The lender always keeps its last token, so that
+     * a control storm only takes its spare credit and cannot starve it */
+    for(i = 0; i < ORPL_BROADCAST_CLASSES; i++) {
+      if(broadcast_buckets[i].tokens > 1
+          && broadcast_buckets[i].priority < broadcast_buckets[class].priority
+          && (b == NULL || broadcast_buckets[i].priority < b->priority)) {
+        b = &broadcast_buckets[i];
+      }
+    }
+  }
+
+  if(b == NULL) {
+    ORPL_LOG("Cmac: broadcast class %u rate limited\n", class);
+    return 1;
+  }
+  b->tokens--;
+  return 0;
+#elif CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT
   if(!timer_expired(&broadcast_rate_timer)) {
     broadcast_rate_counter++;
     if(broadcast_rate_counter < CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT) {
@@ -553,6 +818,349 @@ broadcast_rate_drop(void)
 #endif /* CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT */
 }
 /*---------------------------------------------------------------------------*/
+/* Reason of a collision due to an incoming frame. A frame we decided to
+ * ack is for us; frames still being received before the ack decision,
+ * and frames we did not ack, are foreign. */
+static uint8_t
+rx_collision_reason(void)
+{
+  if(NETSTACK_RADIO.pending_packet() && orpl_anycast_last_input_acked()) {
+    return collision_rx_for_us;
+  }
+  return collision_rx_foreign;
+}
+/*---------------------------------------------------------------------------*/
+#if ORPL_WITH_ADAPTIVE_CYCLE
+/* Channel check level of neighbors, as advertised in their ACKs */
+struct cycle_level_entry {
+  uint8_t level;
+};
+NBR_TABLE(struct cycle_level_entry, cycle_levels);
+
+static struct ctimer adaptive_cycle_timer;
+
+/* Periodically update our level from the ratio of received frames to wake-ups */
+static void
+adaptive_cycle_update(void *ptr)
+{
+  uint8_t level = contikimac_cycle_level;
+
+  if((uint32_t)adaptive_rx_count * ADAPTIVE_CYCLE_HIGH > adaptive_wakeup_count) {
+    if(level < ADAPTIVE_CYCLE_LEVELS - 1) {
+      level++;
+    }
+  } else if((uint32_t)adaptive_rx_count * ADAPTIVE_CYCLE_LOW < adaptive_wakeup_count) {
+    if(level > 0) {
+      level--;
+    }
+  }
+
+  if(level != contikimac_cycle_level) {
+    ORPL_LOG("Cmac: cycle level %u -> %u (rx %u, wake-ups %u)\n",
+        contikimac_cycle_level, level, adaptive_rx_count, adaptive_wakeup_count);
+    contikimac_cycle_level = level;
+  }
+
+  adaptive_rx_count = 0;
+  adaptive_wakeup_count = 0;
+  ctimer_set(&adaptive_cycle_timer, ADAPTIVE_CYCLE_PERIOD, adaptive_cycle_update, NULL);
+}
+
+/* Record the level of a neighbor that just acked us */
+static void
+cycle_level_update(const rimeaddr_t *addr, uint8_t level)
+{
+  struct cycle_level_entry *e = nbr_table_get_from_lladdr(cycle_levels, addr);
+  if(e == NULL) {
+    e = nbr_table_add_lladdr(cycle_levels, addr);
+  }
+  if(e != NULL && level < ADAPTIVE_CYCLE_LEVELS) {
+    e->level = level;
+  }
+}
+
+/* Returns the cycle time of a neighbor, CYCLE_TIME if unknown */
+static rtimer_clock_t
+neighbor_cycle_time(const rimeaddr_t *addr)
+{
+  struct cycle_level_entry *e = nbr_table_get_from_lladdr(cycle_levels, addr);
+  return e != NULL ? LEVEL_CYCLE_TIME(e->level) : CYCLE_TIME;
+}
+
+/* Returns the strobe time needed to cover the longest cycle among the
+ * neighbors that may ack the packet in packetbuf. Broadcasts, packets with
+ * no candidate, and packets with a candidate whose level we do not know
+ * use the default STROBE_TIME. */
+static rtimer_clock_t
+adaptive_strobe_time(uint8_t is_broadcast)
+{
+  uint8_t is_up = packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_up;
+  rpl_rank_t curr_edc = orpl_current_edc();
+  uint16_t edc_w = orpl_edc_w();
+  uint8_t min_level = ADAPTIVE_CYCLE_LEVELS;
+  struct cycle_level_entry *e;
+  rpl_parent_t *p;
+
+  if(is_broadcast) {
+    return STROBE_TIME;
+  }
+
+  for(p = nbr_table_head(rpl_parents); p != NULL;
+      p = nbr_table_next(rpl_parents, p)) {
+    if(is_up && (curr_edc <= edc_w || p->rank >= curr_edc - edc_w)) {
+      /* Upwards, only forwarders may ack */
+      continue;
+    }
+    e = nbr_table_get_from_lladdr(cycle_levels, nbr_table_get_lladdr(rpl_parents, p));
+    if(e == NULL) {
+      /* This candidate may be the only one to ack, and may wake up once
+       * per full cycle */
+      return STROBE_TIME;
+    }
+    if(e->level < min_level) {
+      min_level = e->level;
+    }
+  }
+
+  if(min_level == ADAPTIVE_CYCLE_LEVELS) {
+    return STROBE_TIME;
+  }
+  return LEVEL_CYCLE_TIME(min_level) + 2 * CHECK_TIME;
+}
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+/*---------------------------------------------------------------------------*/
+#if ORPL_WITH_RI_PROBES
+/* Receiver-initiated mode. Probers send a short probe when they are ready to
+ * receive. A sender with an upwards packet that heard a forwarder probe
+ * within RI_PROBER_TIMEOUT listens for the next probe, and transmits right
+ * after it rather than strobing for a full cycle. */
+static struct ctimer ri_probe_timer;
+static uint8_t ri_probe_seqno;
+/* Last time we heard a probe from a forwarder, 0 if never */
+static clock_time_t ri_last_prober;
+
+/* Send a probe, unless we or the radio are busy. Returns 1 if the probe
+ * was sent. Called from process context only: like send_packet, it keeps
+ * the powercycle off the radio with we_are_sending. */
+static int
+ri_probe_send(void)
+{
+  uint8_t probe[RI_PROBE_LEN];
+  int ret;
+
+  if(we_are_sending || we_are_receiving_burst ||
+     NETSTACK_RADIO.receiving_packet() || NETSTACK_RADIO.pending_packet()) {
+    return 0;
+  }
+  orpl_anycast_build_probe(probe, ri_probe_seqno);
+  we_are_sending = 1;
+  ret = NETSTACK_RADIO.send(probe, RI_PROBE_LEN);
+  we_are_sending = 0;
+  if(ret != RADIO_TX_OK) {
+    return 0;
+  }
+  ri_probe_seqno++;
+  return 1;
+}
+
+/* Nodes that are always on probe periodically */
+static void
+ri_probe_periodic(void *ptr)
+{
+  if(!contikimac_is_on && contikimac_keep_radio_on) {
+    ri_probe_send();
+  }
+  ctimer_reset(&ri_probe_timer);
+}
+
+#if ORPL_WITH_ADAPTIVE_CYCLE
+/* Sends the wake-up probes requested by the powercycle */
+PROCESS_THREAD(ri_probe_process, ev, data)
+{
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+    if(ri_probe_requested && ri_probe_send()) {
+      ri_probe_sent = 1;
+    }
+  }
+
+  PROCESS_END();
+}
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
+/* Returns 1 if a probe with this EDC comes from one of our forwarders */
+static int
+ri_is_forwarder(rpl_rank_t probe_edc)
+{
+  rpl_rank_t curr_edc = orpl_current_edc();
+  uint16_t edc_w = orpl_edc_w();
+  return curr_edc != 0xffff && curr_edc > edc_w && probe_edc < curr_edc - edc_w;
+}
+
+/* Read a probe out of the radio, so it is not mistaken for an ACK */
+static void
+ri_probe_drain(void)
+{
+  uint8_t buf[RI_PROBE_LEN];
+  rtimer_clock_t wt = RTIMER_NOW();
+  while(!NETSTACK_RADIO.pending_packet() &&
+        RTIMER_CLOCK_LT(RTIMER_NOW(), wt + AFTER_ACK_DETECTECT_WAIT_TIME)) { }
+  if(NETSTACK_RADIO.pending_packet()) {
+    NETSTACK_RADIO.read(buf, RI_PROBE_LEN);
+  }
+}
+
+/* Listen for a probe from a forwarder before sending the upwards packet
+ * in packetbuf. Called from send_packet, in process context, for at most
+ * RI_PROBE_WAIT. Returns RI_PROBE_HEARD if one was heard, RI_PROBE_RX if
+ * another frame was received meanwhile, RI_PROBE_NONE otherwise */
+static int
+ri_probe_wait(void)
+{
+  rtimer_clock_t wt;
+
+  if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_up
+      || ri_last_prober == 0 || clock_time() - ri_last_prober > RI_PROBER_TIMEOUT) {
+    return RI_PROBE_NONE;
+  }
+
+  /* Forget about probes heard before */
+  orpl_anycast_last_probe_edc();
+  wt = RTIMER_NOW();
+  on();
+  while(RTIMER_CLOCK_LT(RTIMER_NOW(), wt + RI_PROBE_WAIT)) {
+    rpl_rank_t probe_edc = orpl_anycast_last_probe_edc();
+    if(probe_edc != 0xffff) {
+      ri_probe_drain();
+      if(ri_is_forwarder(probe_edc)) {
+        ri_last_prober = clock_time();
+        return RI_PROBE_HEARD;
+      }
+    } else if(NETSTACK_RADIO.pending_packet()) {
+      /* Not a probe: let it be processed */
+      return RI_PROBE_RX;
+    }
+  }
+  off();
+  return RI_PROBE_NONE;
+}
+#endif /* ORPL_WITH_RI_PROBES */
+/*---------------------------------------------------------------------------*/
+#if ORPL_WITH_PHASE_TRACKER
+/* Forwarder-set phase tracking. ContikiMAC's phase optimization does not apply
+ * to anycast, as there is no single receiver. Instead, we record the wake-up
+ * phase of every neighbor that acks us, and start upwards strobes GUARD_TIME
+ * before the earliest expected wake-up among the neighbors that are allowed
+ * to ack them, i.e. with a rank below our EDC minus EDC_W. */
+struct phase_tracker_entry {
+  rtimer_clock_t time; /* A time at which the neighbor was awake */
+  clock_time_t last_update; /* For ageing, as clocks drift */
+  clock_time_t last_anchor; /* When time was last moved close to now */
+};
+NBR_TABLE(struct phase_tracker_entry, phase_tracker);
+
+/* Phases older than this are not used anymore */
+#define PHASE_TRACKER_MAX_AGE              (30 * CLOCK_SECOND)
+/* Beyond half the rtimer range, RTIMER_CLOCK_LT cannot tell whether an
+ * anchor is in the past or in the future. Anchors are moved forward by
+ * whole cycles on every use, and dropped when not used for that long. */
+#define PHASE_TRACKER_MAX_ANCHOR_AGE \
+    ((clock_time_t)(((rtimer_clock_t)~0 >> 1) / (RTIMER_ARCH_SECOND / CLOCK_SECOND)))
+/* Waits longer than this are deferred with a ctimer rather than busy-waited */
+#define PHASE_TRACKER_MAX_BUSY_WAIT        (2 * RTIMER_ARCH_SECOND / CLOCK_SECOND)
+
+/* A single transmission can be deferred at a time. Upwards transmissions
+ * issued meanwhile are not deferred, they go out right away. */
+static struct ctimer phase_tracker_timer;
+static mac_callback_t phase_deferred_sent;
+static void *phase_deferred_ptr;
+static struct rdc_buf_list *phase_deferred_buf_list;
+static uint8_t phase_deferred_state;
+#define PHASE_DEFERRED_NONE                0
+#define PHASE_DEFERRED_WAITING             1
+#define PHASE_DEFERRED_RESUMED             2
+
+static void qsend_list(mac_callback_t sent, void *ptr, struct rdc_buf_list *buf_list);
+
+/* Record the phase of a neighbor that just acked us */
+static void
+phase_tracker_update(const rimeaddr_t *addr, rtimer_clock_t time)
+{
+  struct phase_tracker_entry *e = nbr_table_get_from_lladdr(phase_tracker, addr);
+  if(e == NULL) {
+    e = nbr_table_add_lladdr(phase_tracker, addr);
+  }
+  if(e != NULL) {
+    e->time = time;
+    e->last_update = clock_time();
+    e->last_anchor = e->last_update;
+  }
+}
+
+/* Returns the time from now until GUARD_TIME before the next expected wake-up
+ * of a forwarder, or 0 if we should send right away (including when unknown) */
+static rtimer_clock_t
+phase_tracker_wait(rtimer_clock_t now)
+{
+  rpl_rank_t curr_edc = orpl_current_edc();
+  uint16_t edc_w = orpl_edc_w();
+  rtimer_clock_t min_wait = CYCLE_TIME;
+  struct phase_tracker_entry *e;
+
+  if(curr_edc == 0xffff || curr_edc <= edc_w) {
+    return 0;
+  }
+
+  for(e = nbr_table_head(phase_tracker); e != NULL;
+      e = nbr_table_next(phase_tracker, e)) {
+    rpl_parent_t *p = rpl_get_parent((uip_lladdr_t *)nbr_table_get_lladdr(phase_tracker, e));
+    rtimer_clock_t wait, elapsed;
+#if ORPL_WITH_ADAPTIVE_CYCLE
+    rtimer_clock_t cycle = neighbor_cycle_time(nbr_table_get_lladdr(phase_tracker, e));
+#else /* ORPL_WITH_ADAPTIVE_CYCLE */
+    rtimer_clock_t cycle = CYCLE_TIME;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
+    if(p == NULL || p->rank >= curr_edc - edc_w
+        || clock_time() - e->last_update > PHASE_TRACKER_MAX_AGE
+        || clock_time() - e->last_anchor > PHASE_TRACKER_MAX_ANCHOR_AGE) {
+      /* Not a forwarder, or phase too old */
+      continue;
+    }
+    if(RTIMER_CLOCK_LT(now, e->time)) {
+      wait = (rtimer_clock_t)(e->time - now) % cycle;
+    } else {
+      /* Move the anchor to the latest wake-up, so that it stays within
+       * the rtimer range. Does not assume that cycle divides it. */
+      elapsed = (rtimer_clock_t)(now - e->time) % cycle;
+      e->time = now - elapsed;
+      e->last_anchor = clock_time();
+      wait = elapsed == 0 ? 0 : cycle - elapsed;
+    }
+    if(wait <= GUARD_TIME) {
+      /* The forwarder is about to wake up */
+      return 0;
+    }
+    if(wait - GUARD_TIME < min_wait) {
+      min_wait = wait - GUARD_TIME;
+    }
+  }
+
+  return min_wait == CYCLE_TIME ? 0 : min_wait;
+}
+
+/* Resume a deferred transmission */
+static void
+phase_tracker_resume(void *ptr)
+{
+  phase_deferred_state = PHASE_DEFERRED_RESUMED;
+  qsend_list(phase_deferred_sent, phase_deferred_ptr, phase_deferred_buf_list);
+  phase_deferred_state = PHASE_DEFERRED_NONE;
+}
+#endif /* ORPL_WITH_PHASE_TRACKER */
+/*---------------------------------------------------------------------------*/
 static int
 send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 	    struct rdc_buf_list *buf_list,
@@ -562,6 +1170,7 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
   rtimer_clock_t t0;
   rtimer_clock_t encounter_time = 0, previous_txtime = 0;
   int strobes;
+  rtimer_clock_t strobe_time = STROBE_TIME;
   uint8_t got_strobe_ack = 0;
   int hdrlen, len;
   uint8_t is_broadcast = 0;
@@ -573,6 +1182,17 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 #if WITH_CONTIKIMAC_HEADER
   struct hdr *chdr;
 #endif /* WITH_CONTIKIMAC_HEADER */
+#if ORPL_WITH_PHASE_TRACKER
+  rtimer_clock_t tracker_start = 0;
+  rtimer_clock_t tracker_wait = 0;
+#endif /* ORPL_WITH_PHASE_TRACKER */
+
+  packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, collision_none);
+  if(!NETSTACK_RADIO.pending_packet()) {
+    /* The ack decision is about a frame we already read. Frames still
+     * pending in the radio keep theirs, see rx_collision_reason */
+    orpl_anycast_clear_last_input_acked();
+  }
 
   /* Exit if RDC and radio were explicitly turned off */
    if(!contikimac_is_on && !contikimac_keep_radio_on) {
@@ -595,6 +1215,7 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 
     if(broadcast_rate_drop()) {
       collision_count++;
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, collision_rate_limit);
       return MAC_TX_COLLISION;
     }
   } else {
@@ -619,6 +1240,32 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 #endif /* UIP_CONF_IPV6 */
   }
 
+#if ORPL_WITH_PHASE_TRACKER
+  /* Decide on deferring before building the frame and preparing the radio */
+  if(!is_broadcast && !is_receiver_awake
+      && packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_up) {
+    tracker_start = RTIMER_NOW();
+    tracker_wait = phase_tracker_wait(tracker_start);
+    if(tracker_wait > PHASE_TRACKER_MAX_BUSY_WAIT) {
+      if(buf_list != NULL && phase_deferred_state == PHASE_DEFERRED_NONE) {
+        /* Sleep until shortly before the forwarder set wakes up */
+        phase_deferred_state = PHASE_DEFERRED_WAITING;
+        phase_deferred_sent = mac_callback;
+        phase_deferred_ptr = mac_callback_ptr;
+        phase_deferred_buf_list = buf_list;
+        ctimer_set(&phase_tracker_timer,
+            (uint32_t)(tracker_wait - PHASE_TRACKER_MAX_BUSY_WAIT) * CLOCK_SECOND / RTIMER_ARCH_SECOND,
+            phase_tracker_resume, NULL);
+        return MAC_TX_DEFERRED;
+      }
+      if(phase_deferred_state == PHASE_DEFERRED_WAITING) {
+        ORPL_LOG("Cmac: phase tracker busy, sending right away\n");
+      }
+      tracker_wait = 0;
+    }
+  }
+#endif /* ORPL_WITH_PHASE_TRACKER */
+
   packetbuf_set_attr(PACKETBUF_ATTR_MAC_ACK, 1);
 
 #if WITH_CONTIKIMAC_HEADER
@@ -631,6 +1278,29 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
   chdr = packetbuf_hdrptr();
   chdr->id = CONTIKIMAC_ID;
   chdr->len = hdrlen;
+#if ORPL_WITH_TX_BUDGET
+  chdr->budget = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+  chdr->priority = packetbuf_attr(PACKETBUF_ATTR_ORPL_PRIORITY);
+  {
+    uint16_t deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+    uint16_t lifetime = 0;
+    if(deadline != 0) {
+      /* An expired packet still gets a lifetime, the next hop drops it */
+      lifetime = CLOCK_LT((uint16_t)clock_time(), deadline) ?
+          deadline - (uint16_t)clock_time() : 1;
+    }
+    chdr->lifetime[0] = lifetime >> 8;
+    chdr->lifetime[1] = lifetime;
+  }
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+#if ORPL_WITH_BURST
+  /* Pin the rest of a burst to the forwarder that acked its first frame,
+   * so that no other forwarder takes part of it */
+  rimeaddr_copy(&chdr->burst_receiver,
+      is_receiver_awake ? &burst_receiver : &rimeaddr_null);
+#endif /* ORPL_WITH_BURST */
   
   /* Create the MAC header for the data packet. */
   hdrlen = NETSTACK_FRAMER.create();
@@ -655,17 +1325,21 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
      packet length. */
   transmit_len = packetbuf_totlen();
   if(transmit_len < SHORTEST_PACKET_SIZE) {
+#if !WITH_RADIO_PADDING
     /* Pad with zeroes */
     uint8_t *ptr;
     ptr = packetbuf_dataptr();
     memset(ptr + packetbuf_datalen(), 0, SHORTEST_PACKET_SIZE - packetbuf_totlen());
+#endif /* !WITH_RADIO_PADDING */
 
     PRINTF("contikimac: shorter than shortest (%d)\n", packetbuf_totlen());
     transmit_len = SHORTEST_PACKET_SIZE;
   }
 
 
+#if !WITH_ZERO_COPY
   packetbuf_compact();
+#endif /* !WITH_ZERO_COPY */
 
 #ifdef NETSTACK_ENCRYPT
   NETSTACK_ENCRYPT();
@@ -675,7 +1349,15 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
   transmit_len = packetbuf_totlen();
 #endif /* !WITH_CONTIKIMAC_HEADER */
 
+#if WITH_RADIO_PADDING
+  /* The radio pads the frame up to transmit_len. With WITH_ZERO_COPY, the
+     payload is still in the queuebuf referenced by packetbuf. */
+  SOFTACK_DRIVER.prepare_padded(packetbuf_hdrptr(), packetbuf_hdrlen(),
+      packetbuf_is_reference() ? packetbuf_reference_ptr() : packetbuf_dataptr(),
+      packetbuf_datalen(), transmit_len);
+#else /* WITH_RADIO_PADDING */
   NETSTACK_RADIO.prepare(packetbuf_hdrptr(), transmit_len);
+#endif /* WITH_RADIO_PADDING */
 
   /* Remove the MAC-layer header since it will be recreated next time around. */
   packetbuf_hdr_remove(hdrlen);
@@ -692,6 +1374,11 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
       is_known_receiver = 1;
     }
 #endif /* WITH_PHASE_OPTIMIZATION */ 
+#if ORPL_WITH_PHASE_TRACKER
+    /* Short waits for the forwarder set are busy-waited, the radio being
+     * ready to send */
+    while(RTIMER_CLOCK_LT(RTIMER_NOW(), tracker_start + tracker_wait)) { }
+#endif /* ORPL_WITH_PHASE_TRACKER */
   }
   
 
@@ -709,6 +1396,12 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
     we_are_sending = 0;
     PRINTF("contikimac: collision receiving %d, pending %d\n",
            NETSTACK_RADIO.receiving_packet(), NETSTACK_RADIO.pending_packet());
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, rx_collision_reason());
+    collision_count++;
+#if ORPL_WITH_STROBE_STATS
+    orpl_strobe_stats_record(is_broadcast ? direction_none : packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION),
+        NULL, 0, 0, 0, 0, 1);
+#endif /* ORPL_WITH_STROBE_STATS */
     return MAC_TX_COLLISION;
   }
   
@@ -730,11 +1423,35 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
   contikimac_was_on = contikimac_is_on;
   contikimac_is_on = 1;
 
+#if ORPL_WITH_RI_PROBES
+  if(!is_broadcast) {
+    int ri = ri_probe_wait();
+    if(ri == RI_PROBE_HEARD) {
+      /* A forwarder is listening right now, skip the CCA checks */
+      is_receiver_awake = 1;
+    } else if(ri == RI_PROBE_RX) {
+      we_are_sending = 0;
+      off();
+      contikimac_is_on = contikimac_was_on;
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, rx_collision_reason());
+      collision_count++;
+#if ORPL_WITH_STROBE_STATS
+      orpl_strobe_stats_record(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION),
+          NULL, 0, 0, 0, 0, 1);
+#endif /* ORPL_WITH_STROBE_STATS */
+      return MAC_TX_COLLISION;
+    }
+  }
+#endif /* ORPL_WITH_RI_PROBES */
+
 #if !RDC_CONF_HARDWARE_CSMA
     /* Check if there are any transmissions by others. */
     /* TODO: why does this give collisions before sending with the mc1322x? */
   if(is_receiver_awake == 0) {
     int i;
+#if ORPL_WITH_COLLISION_RESCHEDULE
+    int reschedules = 0;
+#endif /* ORPL_WITH_COLLISION_RESCHEDULE */
     for(i = 0; i < CCA_COUNT_MAX_TX; ++i) {
       t0 = RTIMER_NOW();
       on();
@@ -742,6 +1459,25 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
       while(RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + CCA_CHECK_TIME)) { }
 #endif
       if(NETSTACK_RADIO.channel_clear() == 0) {
+#if ORPL_WITH_COLLISION_RESCHEDULE
+        if(reschedules++ < CCA_MAX_RESCHEDULES) {
+          /* Wait for the foreign frame to end */
+          t0 = RTIMER_NOW();
+          while(NETSTACK_RADIO.channel_clear() == 0 &&
+              RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + MAX_FOREIGN_FRAME_TIME)) { }
+          if(!(NETSTACK_RADIO.receiving_packet() || NETSTACK_RADIO.pending_packet())) {
+            /* The channel is free again, restart the CCA checks */
+            off();
+            i = -1;
+            continue;
+          }
+          /* We received the frame: let it be processed */
+          packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, rx_collision_reason());
+        }
+#endif /* ORPL_WITH_COLLISION_RESCHEDULE */
+        if(packetbuf_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON) == collision_none) {
+          packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, collision_channel_busy);
+        }
         collisions++;
         off();
         break;
@@ -757,13 +1493,12 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
     off();
     PRINTF("contikimac: collisions before sending\n");
 
-    uint16_t edc_inc = 1;
-    /* Accumulate strobe duration over multiple CSMA transmissions to get a correct EDC value */
-    uint16_t edc = packetbuf_attr(PACKETBUF_ATTR_EDC) + edc_inc;
-    packetbuf_set_attr(PACKETBUF_ATTR_EDC, edc);
-
     contikimac_is_on = contikimac_was_on;
     collision_count++;
+#if ORPL_WITH_STROBE_STATS
+    orpl_strobe_stats_record(is_broadcast ? direction_none : packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION),
+        NULL, 0, 0, 0, 0, collisions);
+#endif /* ORPL_WITH_STROBE_STATS */
     return MAC_TX_COLLISION;
   }
 #endif /* RDC_CONF_HARDWARE_CSMA */
@@ -778,6 +1513,18 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 
   uint8_t ackbuf[ACK_LEN];
   rimeaddr_t dest;
+#if ORPL_WITH_SFD_ACK_DETECTION
+  /* Time at which the SFD of the last ACK was detected */
+  rtimer_clock_t ack_start_time = 0;
+#endif /* ORPL_WITH_SFD_ACK_DETECTION */
+
+#if ORPL_WITH_ADAPTIVE_CYCLE
+  strobe_time = adaptive_strobe_time(is_broadcast);
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
+  if(is_broadcast) {
+    orpl_broadcast_start();
+  }
 
   watchdog_periodic();
   t0 = RTIMER_NOW();
@@ -785,7 +1532,7 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
   /* In the broadcast case, we keep sending even after getting an ack */
   for(strobes = 0, collisions = 0;
       (is_broadcast || collisions == 0) &&
-      RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + STROBE_TIME); strobes++) {
+      RTIMER_CLOCK_LT(RTIMER_NOW(), t0 + strobe_time); strobes++) {
 
     watchdog_periodic();
 
@@ -813,6 +1560,7 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
       } else if (ret == RADIO_TX_NOACK) {
       } else if (ret == RADIO_TX_COLLISION) {
           PRINTF("contikimac: collisions while sending\n");
+          packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, collision_channel_busy);
           collisions++;
       }
       wt = RTIMER_NOW();
@@ -821,16 +1569,33 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
      /* Wait for the ACK packet */
       wt = RTIMER_NOW();
       NETSTACK_RADIO.on();
+#if ORPL_WITH_SFD_ACK_DETECTION
+      /* Stop waiting as soon as the SFD of a frame is detected */
+      while(!NETSTACK_RADIO.receiving_packet() &&
+            !NETSTACK_RADIO.pending_packet() &&
+            RTIMER_CLOCK_LT(RTIMER_NOW(), wt + ACK_START_TIMEOUT)) { }
+      ack_start_time = RTIMER_NOW();
+#else /* ORPL_WITH_SFD_ACK_DETECTION */
       while(RTIMER_CLOCK_LT(RTIMER_NOW(), wt + INTER_PACKET_INTERVAL)) { }
+#endif /* ORPL_WITH_SFD_ACK_DETECTION */
 
       if(NETSTACK_RADIO.receiving_packet() ||
                            NETSTACK_RADIO.pending_packet() ||
                            NETSTACK_RADIO.channel_clear() == 0) {
         wt = RTIMER_NOW();
+#if ORPL_WITH_SFD_ACK_DETECTION
+        /* The FIFOP interrupt moves the frame to the pending list once
+         * fully received, read it right away */
+        while(!NETSTACK_RADIO.pending_packet() &&
+              RTIMER_CLOCK_LT(RTIMER_NOW(), wt + ACK_RECEIVE_TIMEOUT)) { }
+#else /* ORPL_WITH_SFD_ACK_DETECTION */
         while(RTIMER_CLOCK_LT(RTIMER_NOW(), wt + AFTER_ACK_DETECTECT_WAIT_TIME)) { }
+#endif /* ORPL_WITH_SFD_ACK_DETECTION */
 
         len = NETSTACK_RADIO.read(ackbuf, ACK_LEN);
-        if(len == ACK_LEN && seqno == ackbuf[2]) {
+        /* Check the frame type too, as ACKs and probes may have the same length */
+        if(len == ACK_LEN && (ackbuf[0] & 7) == FRAME802154_ACKFRAME
+            && seqno == ackbuf[2]) {
           /* Received ack for broadcast, perform beacon counting */
           if(is_broadcast) {
             got_strobe_ack++;
@@ -839,13 +1604,38 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
             uint16_t neighbor_rank = (ackbuf[3+8+1]<<8) + ackbuf[3+8];
             rpl_set_parent_rank((uip_lladdr_t *)&dest, neighbor_rank);
             orpl_broadcast_acked(&dest);
+#if ORPL_WITH_ADAPTIVE_CYCLE
+            cycle_level_update(&dest, ackbuf[3+8+2]);
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+#if ORPL_WITH_PHASE_TRACKER
+            phase_tracker_update(&dest, encounter_time);
+#endif /* ORPL_WITH_PHASE_TRACKER */
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+            if(orpl_broadcast_can_stop()) {
+              /* Enough neighbors acked, stop strobing */
+              break;
+            }
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS */
           } else {
           /* Received ack for anycast, stop strobing */
+            memcpy(&dest, ackbuf+3, 8);
+#if ORPL_WITH_BURST
+            if(is_receiver_awake && !rimeaddr_cmp(&dest, &burst_receiver)) {
+              /* Not from the forwarder the burst is pinned to */
+              continue;
+            }
+            rimeaddr_copy(&burst_receiver, &dest);
+#endif /* ORPL_WITH_BURST */
             got_strobe_ack++;
             encounter_time = previous_txtime;
-            memcpy(&dest, ackbuf+3, 8);
             uint16_t neighbor_rank = (ackbuf[3+8+1]<<8) + ackbuf[3+8];
             rpl_set_parent_rank((uip_lladdr_t *)&dest, neighbor_rank);
+#if ORPL_WITH_ADAPTIVE_CYCLE
+            cycle_level_update(&dest, ackbuf[3+8+2]);
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+#if ORPL_WITH_PHASE_TRACKER
+            phase_tracker_update(&dest, encounter_time);
+#endif /* ORPL_WITH_PHASE_TRACKER */
             if(got_strobe_ack >= 1) {
               break;
             }
@@ -862,14 +1652,34 @@ send_packet(mac_callback_t mac_callback, void *mac_callback_ptr,
 	  orpl_broadcast_done();
   }
 
+#if ORPL_WITH_SFD_ACK_DETECTION
+  /* The strobe ended when the ACK started, not when we were done reading it */
+  uint16_t strobe_duration = EDC_TICKS_TO_METRIC(
+      (!is_broadcast && got_strobe_ack ? ack_start_time : RTIMER_NOW()) - t0);
+#else /* ORPL_WITH_SFD_ACK_DETECTION */
   uint16_t strobe_duration = EDC_TICKS_TO_METRIC(RTIMER_NOW() - t0);
-  uint16_t edc_inc = strobe_duration;
-  if(edc_inc < EDC_DIVISOR/16) {
-    edc_inc = EDC_DIVISOR/16; /* Min "penalty" for any attempted tx */
+#endif /* ORPL_WITH_SFD_ACK_DETECTION */
+#if ORPL_WITH_STROBE_STATS
+  {
+    /* For broadcast, the ACK latency is that of the last ACK */
+    rtimer_clock_t strobe_ticks = RTIMER_NOW() - t0;
+    orpl_strobe_stats_record(is_broadcast ? direction_none : packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION),
+        !is_broadcast && got_strobe_ack ? &dest : NULL,
+        strobe_ticks, strobes, got_strobe_ack > 0,
+        is_broadcast ? encounter_time - t0 : strobe_ticks, collisions);
+  }
+#endif /* ORPL_WITH_STROBE_STATS */
+  if(collisions == 0) {
+    /* Accumulate strobe duration over multiple CSMA transmissions to get a
+     * correct EDC value. Only over the attempts csma counts as transmissions:
+     * collisions say little about the forwarders, and are counted apart. */
+    uint16_t edc_inc = strobe_duration;
+    if(edc_inc < EDC_DIVISOR/16) {
+      edc_inc = EDC_DIVISOR/16; /* Min "penalty" for any attempted tx */
+    }
+    uint16_t edc = packetbuf_attr(PACKETBUF_ATTR_EDC) + edc_inc;
+    packetbuf_set_attr(PACKETBUF_ATTR_EDC, edc);
   }
-  /* Accumulate strobe duration over multiple CSMA transmissions to get a correct EDC value */
-  uint16_t edc = packetbuf_attr(PACKETBUF_ATTR_EDC) + edc_inc;
-  packetbuf_set_attr(PACKETBUF_ATTR_EDC, edc);
 
   off();
 
@@ -962,6 +1772,9 @@ qsend_list(mac_callback_t sent, void *ptr, struct rdc_buf_list *buf_list)
   struct rdc_buf_list *next;
   int ret;
   int is_receiver_awake;
+#if WITH_ZERO_COPY
+  struct queuebuf *buf;
+#endif /* WITH_ZERO_COPY */
   
   if(curr == NULL) {
     return;
@@ -971,27 +1784,53 @@ qsend_list(mac_callback_t sent, void *ptr, struct rdc_buf_list *buf_list)
     /* Prepare the packetbuf for callback */
     queuebuf_to_packetbuf(curr->buf);
     /* Return COLLISION so the MAC may try again later */
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON, collision_rx_burst);
     mac_call_sent_callback(sent, ptr, MAC_TX_COLLISION, 1);
     return;
   }
   /* The receiver needs to be awoken before we send */
   is_receiver_awake = 0;
   do { /* A loop sending a burst of packets from buf_list */
-//    next = list_item_next(curr);
-    next = NULL; /* The current implementation of ORPL
-    does not support burst. We just send packets one by one. */
+#if ORPL_WITH_BURST
+    /* Once a forwarder acked the first packet, it stays awake as long as we
+     * set the frame pending bit, and acks the next packets of the burst right
+     * away. They are pinned to it, see send_packet.
+     * csma queues per destination, not per anycast address (unless
+     * ORPL_WITH_DIRECTION_QUEUES), so only go on with packets that are
+     * anycast in the same direction, i.e. to the same forwarders. */
+    next = list_item_next(curr);
+    if(next != NULL && queuebuf_attr(next->buf, PACKETBUF_ATTR_ORPL_DIRECTION)
+        != queuebuf_attr(curr->buf, PACKETBUF_ATTR_ORPL_DIRECTION)) {
+      next = NULL;
+    }
+#else /* ORPL_WITH_BURST */
+    next = NULL; /* Burst disabled, we just send packets one by one. */
+#endif /* ORPL_WITH_BURST */
 
     /* Prepare the packetbuf */
+#if WITH_ZERO_COPY
+    /* The MAC frees the queuebuf from its callback, before the upper
+       layers' callbacks read the packetbuf. Hold it until then. */
+    buf = curr->buf;
+    queuebuf_ref(buf);
+    queuebuf_reference_to_packetbuf(buf);
+#else /* WITH_ZERO_COPY */
     queuebuf_to_packetbuf(curr->buf);
-//    if(next != NULL) {
-//      packetbuf_set_attr(PACKETBUF_ATTR_PENDING, 1);
-//    }
+#endif /* WITH_ZERO_COPY */
+    /* Set or clear frame pending, the queuebuf may have been updated
+     * from a previous transmission attempt */
+    packetbuf_set_attr(PACKETBUF_ATTR_PENDING, next != NULL);
 
     /* Send the current packet */
     ret = send_packet(sent, ptr, curr, is_receiver_awake);
     if(ret != MAC_TX_DEFERRED) {
       mac_call_sent_callback(sent, ptr, ret, 1);
     }
+#if WITH_ZERO_COPY
+    /* Do not leave packetbuf referencing a queuebuf we may have freed */
+    queuebuf_free(buf);
+    packetbuf_clear();
+#endif /* WITH_ZERO_COPY */
 
     if(ret == MAC_TX_OK) {
       if(next != NULL) {
@@ -1025,6 +1864,19 @@ input_packet(void)
     off();
   }
 
+#if ORPL_WITH_RI_PROBES
+  {
+    rpl_rank_t probe_edc;
+    if(orpl_anycast_probe_parse(packetbuf_dataptr(), packetbuf_datalen(), &probe_edc)) {
+      /* Remember that a forwarder probes, and drop the probe */
+      if(ri_is_forwarder(probe_edc)) {
+        ri_last_prober = clock_time();
+      }
+      return;
+    }
+  }
+#endif /* ORPL_WITH_RI_PROBES */
+
   if(packetbuf_datalen() > 0) {
     struct anycast_parsing_info ret = orpl_anycast_802154_frame_parse(packetbuf_dataptr(), packetbuf_datalen());
 
@@ -1057,6 +1909,24 @@ input_packet(void)
     }
     packetbuf_hdrreduce(sizeof(struct hdr));
     packetbuf_set_datalen(chdr->len);
+#if ORPL_WITH_TX_BUDGET
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, chdr->budget);
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_PRIORITY, chdr->priority);
+    {
+      uint16_t lifetime = ((uint16_t)chdr->lifetime[0] << 8) | chdr->lifetime[1];
+      uint16_t deadline = 0;
+      if(lifetime != 0) {
+        deadline = (uint16_t)clock_time() + lifetime;
+        if(deadline == 0) {
+          /* 0 stands for no deadline */
+          deadline = 1;
+        }
+      }
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DEADLINE, deadline);
+    }
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
 #endif /* WITH_CONTIKIMAC_HEADER */
 
     if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_none) {
@@ -1078,6 +1948,10 @@ input_packet(void)
       /* This is a regular packet that is destined to us or to the
          broadcast address. */
 
+#if ORPL_WITH_ADAPTIVE_CYCLE
+      adaptive_rx_count++;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
       /* If FRAME_PENDING is set, we are receiving a packets in a burst */
       we_are_receiving_burst = packetbuf_attr(PACKETBUF_ATTR_PENDING);
       if(we_are_receiving_burst) {
@@ -1131,26 +2005,21 @@ input_packet(void)
       PRINTDEBUG("contikimac: data (%u)\n", packetbuf_datalen());
 
       if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_none) {
-        /* Duplicate detection */
+        /* App-layer duplicate detection. Done at RDC layer for simplicity. */
         {
-          int i;
           uint32_t seqno = orpl_packetbuf_seqno();
+          /* fp recovery packets are not dropped as app-layer duplicates */
           if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_recover) {
-            for(i = 0; i < MAX_SEQNOS_APP; ++i) {
-              /* base the comparison on both seqno and false-positive count, so that fp recovery packet
-               * are not dropped as app-layer duplicates */
-              if(seqno == received_app_seqnos[i].seqno) {
-                /* Drop the packet. */
-            	ORPL_LOG_FROM_PACKETBUF("Cmac:! dropping app-layer duplicate from %d",
-            	    ORPL_LOG_NODEID_FROM_RIMEADDR(packetbuf_addr(PACKETBUF_ADDR_SENDER)));
-                return;
-              }
+            if(orpl_app_seqno_contains(seqno)) {
+              /* Drop the packet. */
+              ORPL_LOG_FROM_PACKETBUF("Cmac:! dropping app-layer duplicate from %d",
+                  ORPL_LOG_NODEID_FROM_RIMEADDR(packetbuf_addr(PACKETBUF_ADDR_SENDER)));
+              orpl_anycast_input(1);
+              return;
             }
+            orpl_anycast_input(0);
           }
-          for(i = MAX_SEQNOS_APP - 1; i > 0; --i) {
-            received_app_seqnos[i] = received_app_seqnos[i - 1];
-          }
-          received_app_seqnos[0].seqno = seqno;
+          orpl_app_seqno_insert(seqno);
         }
 
         ORPL_LOG_INC_HOPCOUNT_FROM_PACKETBUF();
@@ -1184,6 +2053,22 @@ init(void)
   phase_init();
 #endif /* WITH_PHASE_OPTIMIZATION */
 
+#if ORPL_WITH_PHASE_TRACKER
+  nbr_table_register(phase_tracker, NULL);
+#endif /* ORPL_WITH_PHASE_TRACKER */
+
+#if ORPL_WITH_ADAPTIVE_CYCLE
+  nbr_table_register(cycle_levels, NULL);
+  ctimer_set(&adaptive_cycle_timer, ADAPTIVE_CYCLE_PERIOD, adaptive_cycle_update, NULL);
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
+#if ORPL_WITH_RI_PROBES
+  ctimer_set(&ri_probe_timer, RI_PROBE_INTERVAL, ri_probe_periodic, NULL);
+#if ORPL_WITH_ADAPTIVE_CYCLE
+  process_start(&ri_probe_process, NULL);
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+#endif /* ORPL_WITH_RI_PROBES */
+
 }
 /*---------------------------------------------------------------------------*/
 static int
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Simulated radio with softack support, for the native target.
+ *         Frames are exchanged as UDP datagrams on a multicast group of
+ *         the host, so that all ORPL processes running on the host are
+ *         neighbors. Frames are handed to the softack input callback as
+ *         soon as they are received, and the extended ACK it returns is
+ *         sent right away, the same way as cc2420-softack does from the
+ *         FIFOP interrupt. This is meant as a reference for porting
+ *         ORPL's softack to other radios, not as an accurate radio model.
+ * \author
+ *         Simon Duquennoy <simonduq@sics.se>
+ */
+
+#include "contiki.h"
+#include "net/netstack.h"
+#include "net/packetbuf.h"
+#include "net/mac/frame802154.h"
+#include "native-softack.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Multicast group and port used as a shared channel */
+#ifdef NATIVE_SOFTACK_CONF_GROUP
+#define NATIVE_SOFTACK_GROUP NATIVE_SOFTACK_CONF_GROUP
+#else
+#define NATIVE_SOFTACK_GROUP "239.255.21.54"
+#endif
+#ifdef NATIVE_SOFTACK_CONF_PORT
+#define NATIVE_SOFTACK_PORT NATIVE_SOFTACK_CONF_PORT
+#else
+#define NATIVE_SOFTACK_PORT 20154
+#endif
+
+/* Maximum 802.15.4 frame length, without FCS */
+#define MAX_FRAME_LEN 125
+/* Every datagram starts with the pid of the sender, to skip our own frames */
+#define HDR_LEN 4
+/* The channel is reported busy for this long after a frame was heard, so that
+ * ContikiMAC's CCA-based wake-ups detect strobes */
+#define BUSY_TIME (CLOCK_SECOND / 500 + 1)
+/* On-air time of a frame of len bytes at 250 kbps, including the 6-byte
+ * synchronization header and length field and the 2-byte FCS */
+#define FRAME_AIRTIME(len) (((len) + 8) * 32UL * RTIMER_ARCH_SECOND / 1000000 + 1)
+
+PROCESS(native_softack_process, "native softack radio");
+
+static int sock = -1;
+static struct sockaddr_in group_addr;
+static uint32_t our_pid;
+
+static uint8_t tx_buf[MAX_FRAME_LEN];
+static unsigned short tx_len;
+/* A single received frame is buffered, as in cc2420-softack */
+static uint8_t rx_buf[MAX_FRAME_LEN];
+static unsigned short rx_len;
+static uint8_t receive_on;
+static clock_time_t last_activity;
+/* End of the frame last heard. Datagrams arrive whole, so the radio is
+ * reported as receiving for the airtime of the frame, the time the cc2420
+ * holds SFD high */
+static rtimer_clock_t rx_end;
+
+static softack_input_callback_f *softack_input_callback;
+static softack_acked_callback_f *softack_acked_callback;
+
+/*---------------------------------------------------------------------------*/
+static void
+send_frame(const uint8_t *frame, unsigned short len)
+{
+  uint8_t buf[HDR_LEN + MAX_FRAME_LEN];
+
+  if(sock < 0 || len > MAX_FRAME_LEN) {
+    return;
+  }
+  memcpy(buf, &our_pid, HDR_LEN);
+  memcpy(buf + HDR_LEN, frame, len);
+  sendto(sock, buf, HDR_LEN + len, 0,
+      (struct sockaddr *)&group_addr, sizeof(group_addr));
+}
+/*---------------------------------------------------------------------------*/
+/* Handle an incoming frame: decide whether to ack it, and buffer it */
+static void
+frame_input(const uint8_t *frame, unsigned short len)
+{
+  uint8_t *ackbuf = NULL;
+  uint8_t acklen = 0;
+
+  last_activity = clock_time();
+  rx_end = RTIMER_NOW() + FRAME_AIRTIME(len);
+
+  if(!receive_on || rx_len > 0) {
+    /* Radio off or buffer full: the frame is lost */
+    return;
+  }
+
+  if(softack_input_callback) {
+    softack_input_callback(frame, len, &ackbuf, &acklen);
+  }
+  if(acklen > 0) {
+    send_frame(ackbuf, acklen);
+    if(softack_acked_callback) {
+      softack_acked_callback(frame, len);
+    }
+  }
+
+  memcpy(rx_buf, frame, len);
+  rx_len = len;
+  process_poll(&native_softack_process);
+}
+/*---------------------------------------------------------------------------*/
+/* Pull all pending datagrams. Called from every driver function that
+ * ContikiMAC busy-waits on, as the main loop does not run meanwhile */
+static void
+poll_socket(void)
+{
+  uint8_t buf[HDR_LEN + MAX_FRAME_LEN];
+  ssize_t n;
+
+  if(sock < 0) {
+    return;
+  }
+  while((n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) > HDR_LEN) {
+    if(memcmp(buf, &our_pid, HDR_LEN) != 0) {
+      frame_input(buf + HDR_LEN, n - HDR_LEN);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+set_fd(fd_set *rset, fd_set *wset)
+{
+  FD_SET(sock, rset);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_fd(fd_set *rset, fd_set *wset)
+{
+  if(FD_ISSET(sock, rset)) {
+    poll_socket();
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const struct select_callback native_softack_select = {set_fd, handle_fd};
+/*---------------------------------------------------------------------------*/
+static int
+native_init(void)
+{
+  struct ip_mreq mreq;
+  struct sockaddr_in addr;
+  int one = 1;
+  unsigned char loop = 1;
+
+  our_pid = getpid();
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if(sock < 0) {
+    perror("native-softack: socket");
+    return 0;
+  }
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+  setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(NATIVE_SOFTACK_PORT);
+  if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("native-softack: bind");
+    close(sock);
+    sock = -1;
+    return 0;
+  }
+
+  mreq.imr_multiaddr.s_addr = inet_addr(NATIVE_SOFTACK_GROUP);
+  mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq.imr_interface, sizeof(mreq.imr_interface));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+  memset(&group_addr, 0, sizeof(group_addr));
+  group_addr.sin_family = AF_INET;
+  group_addr.sin_addr.s_addr = inet_addr(NATIVE_SOFTACK_GROUP);
+  group_addr.sin_port = htons(NATIVE_SOFTACK_PORT);
+
+  select_set_callback(sock, &native_softack_select);
+  process_start(&native_softack_process, NULL);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_prepare(const void *payload, unsigned short payload_len)
+{
+  if(payload_len > MAX_FRAME_LEN) {
+    return RADIO_TX_ERR;
+  }
+  memcpy(tx_buf, payload, payload_len);
+  tx_len = payload_len;
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_prepare_padded(const void *hdr, unsigned short hdr_len,
+                      const void *payload, unsigned short payload_len,
+                      unsigned short padded_len)
+{
+  if(padded_len < hdr_len + payload_len) {
+    padded_len = hdr_len + payload_len;
+  }
+  if(padded_len > MAX_FRAME_LEN) {
+    return RADIO_TX_ERR;
+  }
+  memcpy(tx_buf, hdr, hdr_len);
+  memcpy(tx_buf + hdr_len, payload, payload_len);
+  memset(tx_buf + hdr_len + payload_len, 0, padded_len - hdr_len - payload_len);
+  tx_len = padded_len;
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_transmit(unsigned short transmit_len)
+{
+  poll_socket();
+  if(rx_len > 0) {
+    /* Do not overwrite a pending frame, as cc2420-softack */
+    return RADIO_TX_COLLISION;
+  }
+  send_frame(tx_buf, transmit_len < tx_len ? transmit_len : tx_len);
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_send(const void *payload, unsigned short payload_len)
+{
+  if(native_prepare(payload, payload_len) != RADIO_TX_OK) {
+    return RADIO_TX_ERR;
+  }
+  return native_transmit(payload_len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_read(void *buf, unsigned short bufsize)
+{
+  unsigned short len;
+
+  poll_socket();
+  len = rx_len;
+  rx_len = 0;
+  if(len > bufsize) {
+    return 0;
+  }
+  memcpy(buf, rx_buf, len);
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_channel_clear(void)
+{
+  poll_socket();
+  return clock_time() - last_activity >= BUSY_TIME;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_receiving_packet(void)
+{
+  poll_socket();
+  return RTIMER_CLOCK_LT(RTIMER_NOW(), rx_end);
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_pending_packet(void)
+{
+  poll_socket();
+  return rx_len > 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_on(void)
+{
+  receive_on = 1;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+native_off(void)
+{
+  receive_on = 0;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+subscribe(softack_input_callback_f *input_callback, softack_acked_callback_f *acked_callback)
+{
+  softack_input_callback = input_callback;
+  softack_acked_callback = acked_callback;
+}
+/*---------------------------------------------------------------------------*/
+const struct radio_driver native_softack_driver =
+  {
+    native_init,
+    native_prepare,
+    native_transmit,
+    native_send,
+    native_read,
+    native_channel_clear,
+    native_receiving_packet,
+    native_pending_packet,
+    native_on,
+    native_off,
+  };
+
+const struct softack_driver native_softack = {
+  subscribe,
+  native_prepare_padded
+};
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(native_softack_process, ev, data)
+{
+  int len;
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+
+    packetbuf_clear();
+    len = native_read(packetbuf_dataptr(), PACKETBUF_SIZE);
+    /* The MAC reads ACKs straight from the radio while strobing. Any ACK
+     * left in the buffer is dropped here, as in cc2420-softack */
+    if(len > 0 && (((uint8_t *)packetbuf_dataptr())[0] & 7) != FRAME802154_ACKFRAME) {
+      packetbuf_set_datalen(len);
+      NETSTACK_RDC.input();
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,71 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Occupancy and allocation failures of the CSMA memory pools, to
+ *         size them and to spot buffer exhaustion before it causes losses.
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#ifndef __CSMA_STATS_H__
+#define __CSMA_STATS_H__
+
+#include "orpl.h"
+#include "orpl-anycast.h"
+
+/* Number of directions for queue occupancy: direction_none
+ * (unicast and broadcast), up, down, nbr, recover */
+#define CSMA_STATS_DIRECTIONS (direction_recover + 1)
+
+struct csma_pool_stats {
+  uint8_t used; /* Number of slots currently allocated */
+  uint8_t high_water; /* Highest number of slots allocated at once */
+  uint8_t borrowed; /* Number of slots currently borrowed from the shared pool */
+  uint16_t alloc_failures; /* Number of failed allocations */
+};
+
+struct csma_stats {
+  struct csma_pool_stats neighbors; /* Neighbor queues */
+  struct csma_pool_stats packets; /* Packets and their metadata */
+  struct csma_pool_stats shared; /* Shared pool, see CSMA_CONF_SHARED_POOL_SIZE */
+  uint16_t queuebuf_failures; /* Number of failed queuebuf allocations */
+  uint8_t queued[CSMA_STATS_DIRECTIONS]; /* Queued packets per direction */
+  uint8_t queued_high_water[CSMA_STATS_DIRECTIONS]; /* Highest queued per direction */
+};
+
+/* Returns the current CSMA pool statistics */
+const struct csma_stats *csma_stats(void);
+/* Clear failure counts, and set high-water marks to the current occupancy */
+void csma_stats_reset(void);
+
+#endif /* __CSMA_STATS_H__ */
@@ -56,6 +56,9 @@
 #include "orpl.h"
 #include "orpl-anycast.h"
 #define UIP_IP_BUF ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
+#if ORPL_WITH_CSMA_STATS
+#include "net/mac/csma-stats.h"
+#endif /* ORPL_WITH_CSMA_STATS */
 #endif /* WITH_ORPL */
 
 #include <string.h>
@@ -83,11 +86,27 @@
 #error Change CSMA_CONF_MAX_MAC_TRANSMISSIONS in contiki-conf.h or in your Makefile.
 #endif /* CSMA_CONF_MAX_MAC_TRANSMISSIONS < 1 */
 
+#if WITH_ORPL
+/* Retransmission time after a collision with an incoming frame for us, see
+   ORPL_WITH_COLLISION_RESCHEDULE. Long enough for the frame to be processed. */
+#define COLLISION_RX_RETRY_TIME (CLOCK_SECOND / 64)
+#endif /* WITH_ORPL */
+
 /* Packet metadata */
 struct qbuf_metadata {
   mac_callback_t sent;
   void *cptr;
   uint8_t max_transmissions;
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+  uint8_t priority;
+  uint16_t deadline; /* 0 for none */
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+  uint8_t direction; /* For per-direction occupancy */
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+  uint8_t budget; /* End-to-end transmissions left when queued, 0 for none */
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
 };
 
 /* Every neighbor has its own packet queue */
@@ -97,6 +116,9 @@ struct neighbor_queue {
   struct ctimer transmit_timer;
   uint8_t transmissions;
   uint8_t collisions, deferrals;
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+  uint8_t in_flight; /* The head was handed to the RDC, not yet called back */
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
   LIST_STRUCT(queued_packet_list);
 };
 
@@ -107,15 +129,172 @@ struct neighbor_queue {
 #define CSMA_MAX_NEIGHBOR_QUEUES 2
 #endif /* CSMA_CONF_MAX_NEIGHBOR_QUEUES */
 
+/* The maximum number of queued packets */
+#ifdef CSMA_CONF_MAX_QUEUED_PACKETS
+#define MAX_QUEUED_PACKETS CSMA_CONF_MAX_QUEUED_PACKETS
+#else /* CSMA_CONF_MAX_QUEUED_PACKETS */
 #define MAX_QUEUED_PACKETS QUEUEBUF_NUM
+#endif /* CSMA_CONF_MAX_QUEUED_PACKETS */
+
+/* The number of slots shared between neighbor queues and packets. Either
+   borrows from the shared pool once its own pool is exhausted. */
+#ifdef CSMA_CONF_SHARED_POOL_SIZE
+#define CSMA_SHARED_POOL_SIZE CSMA_CONF_SHARED_POOL_SIZE
+#else /* CSMA_CONF_SHARED_POOL_SIZE */
+#define CSMA_SHARED_POOL_SIZE 0
+#endif /* CSMA_CONF_SHARED_POOL_SIZE */
+
 MEMB(neighbor_memb, struct neighbor_queue, CSMA_MAX_NEIGHBOR_QUEUES);
 MEMB(packet_memb, struct rdc_buf_list, MAX_QUEUED_PACKETS);
 MEMB(metadata_memb, struct qbuf_metadata, MAX_QUEUED_PACKETS);
+#if CSMA_SHARED_POOL_SIZE > 0
+/* A shared slot holds either a neighbor queue or a packet and its metadata */
+union shared_slot {
+  struct neighbor_queue neighbor;
+  struct {
+    struct rdc_buf_list list;
+    struct qbuf_metadata metadata;
+  } packet;
+};
+MEMB(shared_memb, union shared_slot, CSMA_SHARED_POOL_SIZE);
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
 LIST(neighbor_list);
 
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+static struct csma_stats stats;
+#define STATS_ALLOC(pool) stats_alloc(&stats.pool)
+#define STATS_FREE(pool) (stats.pool.used--)
+#define STATS_FAIL(pool) (stats.pool.alloc_failures++)
+#define STATS_BORROW(pool) do { stats.pool.borrowed++; STATS_ALLOC(shared); } while(0)
+#define STATS_RETURN(pool) do { stats.pool.borrowed--; STATS_FREE(shared); } while(0)
+#else /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+#define STATS_ALLOC(pool)
+#define STATS_FREE(pool)
+#define STATS_FAIL(pool)
+#define STATS_BORROW(pool)
+#define STATS_RETURN(pool)
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+
 static void packet_sent(void *ptr, int status, int num_transmissions);
 static void transmit_packet_list(void *ptr);
+static void remove_packet(struct neighbor_queue *n, struct rdc_buf_list *p);
+static void free_packet(struct neighbor_queue *n, struct rdc_buf_list *p);
 
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+/*---------------------------------------------------------------------------*/
+static void
+stats_alloc(struct csma_pool_stats *s)
+{
+  if(++s->used > s->high_water) {
+    s->high_water = s->used;
+  }
+}
+/*---------------------------------------------------------------------------*/
+const struct csma_stats *
+csma_stats(void)
+{
+  return &stats;
+}
+/*---------------------------------------------------------------------------*/
+void
+csma_stats_reset(void)
+{
+  int i;
+  stats.neighbors.high_water = stats.neighbors.used;
+  stats.neighbors.alloc_failures = 0;
+  stats.packets.high_water = stats.packets.used;
+  stats.packets.alloc_failures = 0;
+  stats.shared.high_water = stats.shared.used;
+  stats.shared.alloc_failures = 0;
+  stats.queuebuf_failures = 0;
+  for(i = 0; i < CSMA_STATS_DIRECTIONS; i++) {
+    stats.queued_high_water[i] = stats.queued[i];
+  }
+}
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+/*---------------------------------------------------------------------------*/
+/* Allocate a neighbor queue, from the shared pool if neighbor_memb is full */
+static struct neighbor_queue *
+neighbor_alloc(void)
+{
+  struct neighbor_queue *n = memb_alloc(&neighbor_memb);
+#if CSMA_SHARED_POOL_SIZE > 0
+  if(n == NULL) {
+    n = memb_alloc(&shared_memb);
+    if(n != NULL) {
+      STATS_BORROW(neighbors);
+    }
+  }
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
+  if(n != NULL) {
+    STATS_ALLOC(neighbors);
+  } else {
+    STATS_FAIL(neighbors);
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+neighbor_free(struct neighbor_queue *n)
+{
+#if CSMA_SHARED_POOL_SIZE > 0
+  if(memb_inmemb(&shared_memb, n)) {
+    memb_free(&shared_memb, n);
+    STATS_RETURN(neighbors);
+  } else
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
+  {
+    memb_free(&neighbor_memb, n);
+  }
+  STATS_FREE(neighbors);
+}
+/*---------------------------------------------------------------------------*/
+/* Allocate a packet and its metadata, from the shared pool if
+   packet_memb or metadata_memb is full */
+static struct rdc_buf_list *
+packet_alloc(void)
+{
+  struct rdc_buf_list *q = memb_alloc(&packet_memb);
+  if(q != NULL) {
+    q->ptr = memb_alloc(&metadata_memb);
+    if(q->ptr == NULL) {
+      memb_free(&packet_memb, q);
+      q = NULL;
+    }
+  }
+#if CSMA_SHARED_POOL_SIZE > 0
+  if(q == NULL) {
+    union shared_slot *slot = memb_alloc(&shared_memb);
+    if(slot != NULL) {
+      q = &slot->packet.list;
+      q->ptr = &slot->packet.metadata;
+      STATS_BORROW(packets);
+    }
+  }
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
+  if(q != NULL) {
+    STATS_ALLOC(packets);
+  } else {
+    STATS_FAIL(packets);
+  }
+  return q;
+}
+/*---------------------------------------------------------------------------*/
+static void
+packet_free(struct rdc_buf_list *q)
+{
+#if CSMA_SHARED_POOL_SIZE > 0
+  if(memb_inmemb(&shared_memb, q)) {
+    memb_free(&shared_memb, q);
+    STATS_RETURN(packets);
+  } else
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
+  {
+    memb_free(&metadata_memb, q->ptr);
+    memb_free(&packet_memb, q);
+  }
+  STATS_FREE(packets);
+}
 /*---------------------------------------------------------------------------*/
 static struct neighbor_queue *
 neighbor_queue_from_addr(const rimeaddr_t *addr)
@@ -130,6 +309,18 @@ neighbor_queue_from_addr(const rimeaddr_t *addr)
   return NULL;
 }
 /*---------------------------------------------------------------------------*/
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+/* Is addr one of the anycast addresses, i.e. a direction queue */
+static int
+is_anycast_addr(const rimeaddr_t *addr)
+{
+  return rimeaddr_cmp(addr, &anycast_addr_up)
+      || rimeaddr_cmp(addr, &anycast_addr_down)
+      || rimeaddr_cmp(addr, &anycast_addr_nbr)
+      || rimeaddr_cmp(addr, &anycast_addr_recover);
+}
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
+/*---------------------------------------------------------------------------*/
 static clock_time_t
 default_timebase(void)
 {
@@ -147,31 +338,193 @@ default_timebase(void)
   return time;
 }
 /*---------------------------------------------------------------------------*/
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+/* Drop the packets of n whose deadline has passed, anywhere in the queue.
+   Returns 0 if n was freed as a result. */
+static int
+drop_expired(struct neighbor_queue *n)
+{
+  struct rdc_buf_list *q;
+  struct rdc_buf_list *next;
+  struct qbuf_metadata *metadata;
+  mac_callback_t sent;
+  void *cptr;
+  int last;
+
+  for(q = list_head(n->queued_packet_list); q != NULL; q = next) {
+    next = list_item_next(q);
+    metadata = (struct qbuf_metadata *)q->ptr;
+    if(metadata->deadline == 0
+        || CLOCK_LT((uint16_t)clock_time(), metadata->deadline)) {
+      continue;
+    }
+    sent = metadata->sent;
+    cptr = metadata->cptr;
+    last = next == NULL && q == list_head(n->queued_packet_list);
+    /* Restore the packet for the upper layer's callback */
+    queuebuf_to_packetbuf(q->buf);
+    ORPL_LOG_FROM_PACKETBUF("Csma:! dropping expired packet");
+    if(q == list_head(n->queued_packet_list)) {
+      free_packet(n, q);
+    } else {
+      /* Not the packet being sent, leave n's tx information alone */
+      remove_packet(n, q);
+    }
+    mac_call_sent_callback(sent, cptr, MAC_TX_ERR, 0);
+    if(last) {
+      return 0;
+    }
+  }
+  return 1;
+}
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
+/*---------------------------------------------------------------------------*/
+#if WITH_ORPL && ORPL_WITH_ANYCAST_BACKOFF
+/* Backoff time base of an anycast: the expected duration of a strobe in its
+   direction, from the hop-by-hop EDC. A single strobe never exceeds a cycle. */
+static clock_time_t
+anycast_timebase(uint8_t direction)
+{
+  clock_time_t timebase = default_timebase();
+  uint16_t hbh_edc = orpl_hbh_edc(direction);
+  clock_time_t time;
+
+  if(direction == direction_up) {
+    if(forwarder_set_size == 0) {
+      /* No forwarder yet, the hop-by-hop EDC is meaningless */
+      return timebase;
+    }
+    /* The upwards hop-by-hop EDC is weighted by the forwarder set size,
+       recovery is accounted with downwards traffic and is not */
+    hbh_edc /= forwarder_set_size;
+  }
+  if(hbh_edc > EDC_DIVISOR) {
+    hbh_edc = EDC_DIVISOR;
+  }
+  time = (uint32_t)timebase * hbh_edc / EDC_DIVISOR;
+  /* Leave room for at least a few strobes of a contender */
+  if(time < timebase / 8 + 1) {
+    time = timebase / 8 + 1;
+  }
+  return time;
+}
+/*---------------------------------------------------------------------------*/
+/* Maximum collision backoff exponent of an anycast */
+static uint8_t
+anycast_backoff_max_exp(uint8_t direction)
+{
+  switch(direction) {
+  case direction_down:
+    return ORPL_ANYCAST_BACKOFF_MAX_EXP_DOWN;
+  case direction_nbr:
+    return ORPL_ANYCAST_BACKOFF_MAX_EXP_NBR;
+  default:
+    return ORPL_ANYCAST_BACKOFF_MAX_EXP_UP;
+  }
+}
+#endif /* WITH_ORPL && ORPL_WITH_ANYCAST_BACKOFF */
+/*---------------------------------------------------------------------------*/
 static void
 transmit_packet_list(void *ptr)
 {
   struct neighbor_queue *n = ptr;
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+  if(n) {
+    if(!drop_expired(n)) {
+      return;
+    }
+    /* free_packet may have set a timer for the new head, we send it now */
+    ctimer_stop(&n->transmit_timer);
+  }
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
   if(n) {
     struct rdc_buf_list *q = list_head(n->queued_packet_list);
     if(q != NULL) {
       PRINTF("csma: preparing number %d %p, queue len %d\n", n->transmissions, q,
           list_length(n->queued_packet_list));
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+      {
+        /* Tell the next hop what is left of the budget, this
+           transmission included. The RDC sends it from the queuebuf
+           attributes, that we update through packetbuf. It is set
+           already for the first transmission. */
+        uint8_t budget = ((struct qbuf_metadata *)q->ptr)->budget;
+        if(budget != 0 && n->transmissions > 0) {
+          queuebuf_to_packetbuf(q->buf);
+          packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, budget - n->transmissions);
+          queuebuf_update_attr_from_packetbuf(q->buf);
+        }
+      }
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+      n->in_flight = 1;
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
       /* Send packets in the neighbor's list */
       NETSTACK_RDC.send_list(packet_sent, n, q);
     }
   }
 }
 /*---------------------------------------------------------------------------*/
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+/* A queue is ready for its turn when it has packets, is not in flight
+   and does not wait for a timer, e.g. a backoff */
+static int
+is_ready(struct neighbor_queue *n)
+{
+  return list_head(n->queued_packet_list) != NULL && !n->in_flight
+      && ctimer_expired(&n->transmit_timer);
+}
+/*---------------------------------------------------------------------------*/
+/* Give the turn to the first ready queue other than n, right away.
+   Returns 0 if there is none. */
+static int
+start_next_ready(struct neighbor_queue *n)
+{
+  struct neighbor_queue *next;
+
+  for(next = list_head(neighbor_list); next != NULL; next = list_item_next(next)) {
+    if(next != n && is_ready(next)) {
+      ctimer_set(&next->transmit_timer, 0, transmit_packet_list, next);
+      return 1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Round-robin scheduling, called when n is done with its head and still
+   has packets: n goes to the back of the line and the first ready queue
+   transmits right away. n is then ready and waits for its turn, or goes
+   on right away if no other queue is ready. Backoffs only follow failed
+   transmissions, see packet_sent. */
+static void
+schedule_next(struct neighbor_queue *n)
+{
+  list_remove(neighbor_list, n);
+  list_add(neighbor_list, n);
+  if(!start_next_ready(n)) {
+    ctimer_set(&n->transmit_timer, 0, transmit_packet_list, n);
+  }
+}
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
+/*---------------------------------------------------------------------------*/
+static void
+remove_packet(struct neighbor_queue *n, struct rdc_buf_list *p)
+{
+  /* Remove packet from list and deallocate */
+  list_remove(n->queued_packet_list, p);
+
+  queuebuf_free(p->buf);
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+  stats.queued[((struct qbuf_metadata *)p->ptr)->direction]--;
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+  packet_free(p);
+}
+/*---------------------------------------------------------------------------*/
 static void
 free_packet(struct neighbor_queue *n, struct rdc_buf_list *p)
 {
   if(p != NULL) {
-    /* Remove packet from list and deallocate */
-    list_remove(n->queued_packet_list, p);
-
-    queuebuf_free(p->buf);
-    memb_free(&metadata_memb, p->ptr);
-    memb_free(&packet_memb, p);
+    remove_packet(n, p);
     PRINTF("csma: free_queued_packet, queue length %d\n",
         list_length(n->queued_packet_list));
     if(list_head(n->queued_packet_list) != NULL) {
@@ -179,14 +532,22 @@ free_packet(struct neighbor_queue *n, struct rdc_buf_list *p)
       n->transmissions = 0;
       n->collisions = 0;
       n->deferrals = 0;
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+      schedule_next(n);
+#else /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
       /* Set a timer for next transmissions */
       ctimer_set(&n->transmit_timer, default_timebase(),
                  transmit_packet_list, n);
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
     } else {
       /* This was the last packet in the queue, we free the neighbor */
       ctimer_stop(&n->transmit_timer);
       list_remove(neighbor_list, n);
-      memb_free(&neighbor_memb, n);
+      neighbor_free(n);
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+      /* Pass the turn on */
+      start_next_ready(NULL);
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
     }
   }
 }
@@ -202,11 +563,27 @@ packet_sent(void *ptr, int status, int num_transmissions)
   void *cptr;
   int num_tx;
   int backoff_transmissions;
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+  uint8_t budget_left;
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
 
   n = ptr;
   if(n == NULL) {
     return;
   }
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+  n->in_flight = 0;
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
+#if WITH_ORPL
+  if(ORPL_WITH_BROADCAST_CLASSES && status == MAC_TX_COLLISION
+      && packetbuf_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON) == collision_rate_limit) {
+    /* The broadcast class is out of budget, a retransmission within
+       the backoff would be dropped again. This says nothing about the
+       link: report it up as deferred, the reason is left in packetbuf
+       for the callback. */
+    status = MAC_TX_DEFERRED;
+  }
+#endif /* WITH_ORPL */
   switch(status) {
   case MAC_TX_OK:
   case MAC_TX_NOACK:
@@ -235,6 +612,11 @@ packet_sent(void *ptr, int status, int num_transmissions)
       sent = metadata->sent;
       cptr = metadata->cptr;
       num_tx = n->transmissions;
+#if WITH_ORPL
+      /* Let the upper layers know what this packet cost, for EDC estimation */
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_TRANSMISSIONS, n->transmissions);
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_COLLISIONS, n->collisions);
+#endif /* WITH_ORPL */
       if(status == MAC_TX_COLLISION ||
          status == MAC_TX_NOACK) {
 
@@ -270,29 +652,125 @@ packet_sent(void *ptr, int status, int num_transmissions)
 
         time = time + (random_rand() % (backoff_transmissions * time));
 
-        if(n->transmissions < metadata->max_transmissions) {
+#if WITH_ORPL
+#if ORPL_WITH_ANYCAST_BACKOFF
+        if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_none) {
+          /* Anycast: the backoff window is a multiple of the expected strobe
+             duration. It doubles with every collision, and grows linearly
+             with unacked transmissions as for unicast. */
+          uint8_t direction = packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION);
+          clock_time_t base = anycast_timebase(direction);
+          clock_time_t window;
+          if(status == MAC_TX_COLLISION) {
+            uint8_t exp = n->collisions;
+            if(exp > anycast_backoff_max_exp(direction)) {
+              exp = anycast_backoff_max_exp(direction);
+            }
+            window = base << exp;
+          } else {
+            window = base * backoff_transmissions;
+          }
+          time = base + (random_rand() % window);
+        }
+#endif /* ORPL_WITH_ANYCAST_BACKOFF */
+        if(ORPL_WITH_COLLISION_RESCHEDULE && status == MAC_TX_COLLISION) {
+          uint8_t reason = packetbuf_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON);
+          if(reason == collision_rx_for_us) {
+            /* We only had to let an incoming frame be received, and its
+               sender stopped strobing as we acked it. Retry right after
+               it is processed rather than after a full backoff. */
+            time = COLLISION_RX_RETRY_TIME + (random_rand() % COLLISION_RX_RETRY_TIME);
+          } else if(reason == collision_rx_foreign) {
+            /* The foreign sender may strobe for up to a channel check
+               interval. Retry at a random point of it, still short of a
+               full backoff. */
+            time = COLLISION_RX_RETRY_TIME + (random_rand() % default_timebase());
+          }
+        }
+#endif /* WITH_ORPL */
+
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+        /* Transmissions left end-to-end, 0xff for packets without budget */
+        budget_left = 0xff;
+        if(metadata->budget != 0) {
+          budget_left = metadata->budget > n->transmissions ?
+              metadata->budget - n->transmissions : 0;
+        }
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
+
+        if(n->transmissions < metadata->max_transmissions
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+            && budget_left > 0
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
+            ) {
           PRINTF("csma: retransmitting with time %lu %p\n", time, q);
           ctimer_set(&n->transmit_timer, time,
                      transmit_packet_list, n);
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+          /* Let another queue transmit while we back off */
+          start_next_ready(n);
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
           /* This is needed to correctly attribute energy that we spent
              transmitting this packet. */
           queuebuf_update_attr_from_packetbuf(q->buf);
         } else {
 #if WITH_ORPL
           /* Failed downwards transmission. Trigger false positive recovery. */
-        	if(ORPL_WITH_FP_RECOVERY && !orpl_is_root() && packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_down) {
+        	if(ORPL_WITH_FP_RECOVERY && !orpl_is_root() && packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_down
+#if ORPL_WITH_TX_BUDGET
+        	    && budget_left > 0
+#endif /* ORPL_WITH_TX_BUDGET */
+        	    ) {
         		ORPL_LOG_FROM_PACKETBUF("Csma:! triggering false positive recovery %u after %d tx, %d c.",
         		    ORPL_LOG_NODEID_FROM_RIMEADDR(&n->addr) , n->transmissions, n->collisions);
         		free_packet(n, q);
         		/* GIve another try, upwards this time, after inserting in blacklist. */
         		orpl_blacklist_insert(orpl_packetbuf_seqno());
+#if ORPL_WITH_FP_CACHE
+        		{
+        		  /* The destination may not be in our subtree after all */
+        		  uip_ipaddr_t dest;
+        		  orpl_packetbuf_dest_ipaddr(&dest);
+        		  orpl_fp_cache_report(&dest, orpl_packetbuf_seqno());
+        		}
+#endif /* ORPL_WITH_FP_CACHE */
         		ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF();
         		ORPL_LOG_FROM_PACKETBUF("Tcpip: false positive recovery");
         		packetbuf_set_attr(PACKETBUF_ATTR_PENDING, 0);
         		packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DIRECTION, direction_recover);
         		packetbuf_set_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS, SICSLOWPAN_CONF_MAX_MAC_TRANSMISSIONS);
+#if ORPL_WITH_TX_BUDGET
+        		/* Recovery starts over per hop, but not end-to-end */
+        		if(packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET) != 0) {
+        		  packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, budget_left);
+        		}
+#endif /* ORPL_WITH_TX_BUDGET */
         		packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &anycast_addr_recover);
         		NETSTACK_MAC.send(sent, cptr);
+#if ORPL_WITH_FP_EXPLORATION
+        	} else if(ORPL_WITH_FP_RECOVERY && !orpl_is_root() && packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_recover
+#if ORPL_WITH_TX_BUDGET
+        	    && budget_left > 0
+#endif /* ORPL_WITH_TX_BUDGET */
+        	    ) {
+        		/* No parent took the recovery back, i.e. the packet did not come
+        		 * down to us (we turned it down after it went up). It is already
+        		 * blacklisted here: keep climbing as a regular upward packet. */
+        		ORPL_LOG_FROM_PACKETBUF("Csma:! recovery not taken back after %d tx, %d c., climbing",
+        		    n->transmissions, n->collisions);
+        		free_packet(n, q);
+        		ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF();
+        		packetbuf_set_attr(PACKETBUF_ATTR_PENDING, 0);
+        		packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DIRECTION, direction_up);
+        		packetbuf_set_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS, SICSLOWPAN_CONF_MAX_MAC_TRANSMISSIONS);
+#if ORPL_WITH_TX_BUDGET
+        		if(packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET) != 0) {
+        		  packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, budget_left);
+        		}
+#endif /* ORPL_WITH_TX_BUDGET */
+        		packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &anycast_addr_up);
+        		NETSTACK_MAC.send(sent, cptr);
+#endif /* ORPL_WITH_FP_EXPLORATION */
         	} else {
         	  ORPL_LOG_FROM_PACKETBUF("Csma:! dropping %u after %d tx, %d collisions",
         	      ORPL_LOG_NODEID_FROM_RIMEADDR(&n->addr) , n->transmissions, n->collisions);
@@ -318,6 +796,8 @@ packet_sent(void *ptr, int status, int num_transmissions)
                 ORPL_LOG_NODEID_FROM_RIMEADDR(packetbuf_addr(PACKETBUF_ADDR_RECEIVER)), n->transmissions, n->collisions);
           }
           PRINTF("csma: rexmit ok %d\n", n->transmissions);
+        } else if(status == MAC_TX_DEFERRED) {
+          ORPL_LOG_FROM_PACKETBUF("Csma:! dropping due to rate limit");
         } else {
           ORPL_LOG_FROM_PACKETBUF("Csma:! dropping due to rexmit failed");
           PRINTF("csma: rexmit failed %d: %d\n", n->transmissions, status);
@@ -341,6 +821,22 @@ send_packet(mac_callback_t sent, void *ptr)
        * We use the IPv6 UUID to have one queue per destination instead. */
     const rimeaddr_t *addr = (const rimeaddr_t *)(((uint8_t*)&UIP_IP_BUF->destipaddr)+8);
 
+#if ORPL_WITH_AGGREGATION
+    /* Datagrams held for aggregation are sent once uip_buf was reused.
+     * 6lowpan gives us their queue's address instead. */
+    if(!rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_ERECEIVER), &rimeaddr_null)) {
+      addr = packetbuf_addr(PACKETBUF_ADDR_ERECEIVER);
+    }
+#endif /* ORPL_WITH_AGGREGATION */
+
+#if ORPL_WITH_DIRECTION_QUEUES
+    /* Anycasts are queued per direction instead, the anycast address
+     * being the queue's address */
+    if(is_anycast_addr(packetbuf_addr(PACKETBUF_ADDR_RECEIVER))) {
+      addr = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
+    }
+#endif /* ORPL_WITH_DIRECTION_QUEUES */
+
     /* Set PACKETBUF_ATTR_ROUTING_SET for outgoing routing set broadcast,
      * so that the proper ORPL callback function can be called after transmission. */
     if(rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER),
@@ -379,13 +875,16 @@ send_packet(mac_callback_t sent, void *ptr)
   n = neighbor_queue_from_addr(addr);
   if(n == NULL) {
     /* Allocate a new neighbor entry */
-    n = memb_alloc(&neighbor_memb);
+    n = neighbor_alloc();
     if(n != NULL) {
       /* Init neighbor entry */
       rimeaddr_copy(&n->addr, addr);
       n->transmissions = 0;
       n->collisions = 0;
       n->deferrals = 0;
+#if WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES
+      n->in_flight = 0;
+#endif /* WITH_ORPL && ORPL_WITH_DIRECTION_QUEUES */
       /* Init packet list for this neighbor */
       LIST_STRUCT_INIT(n, queued_packet_list);
       /* Add neighbor to the list */
@@ -395,10 +894,8 @@ send_packet(mac_callback_t sent, void *ptr)
 
   if(n != NULL) {
     /* Add packet to the neighbor's queue */
-    q = memb_alloc(&packet_memb);
+    q = packet_alloc();
     if(q != NULL) {
-      q->ptr = memb_alloc(&metadata_memb);
-      if(q->ptr != NULL) {
 	q->buf = queuebuf_new_from_packetbuf();
 	if(q->buf != NULL) {
 	  struct qbuf_metadata *metadata = (struct qbuf_metadata *)q->ptr;
@@ -412,10 +909,38 @@ send_packet(mac_callback_t sent, void *ptr)
 	  }
 	  metadata->sent = sent;
 	  metadata->cptr = ptr;
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+	  metadata->priority = packetbuf_attr(PACKETBUF_ATTR_ORPL_PRIORITY);
+	  metadata->deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+	  metadata->budget = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+	  metadata->direction = packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION);
+	  if(metadata->direction >= CSMA_STATS_DIRECTIONS) {
+	    metadata->direction = direction_none;
+	  }
+	  if(++stats.queued[metadata->direction] > stats.queued_high_water[metadata->direction]) {
+	    stats.queued_high_water[metadata->direction] = stats.queued[metadata->direction];
+	  }
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
 
 	  if(packetbuf_attr(PACKETBUF_ATTR_PACKET_TYPE) ==
 	     PACKETBUF_ATTR_PACKET_TYPE_ACK) {
 	    list_push(n->queued_packet_list, q);
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+	  } else if(list_head(n->queued_packet_list) != NULL) {
+	    /* Insert after the packets of higher or equal priority. The head
+	       stays in place, as it may be under transmission. */
+	    struct rdc_buf_list *prev = list_head(n->queued_packet_list);
+	    struct rdc_buf_list *next;
+	    while((next = list_item_next(prev)) != NULL
+	        && ((struct qbuf_metadata *)next->ptr)->priority >= metadata->priority) {
+	      prev = next;
+	    }
+	    list_insert(n->queued_packet_list, prev, q);
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
 	  } else {
 	    list_add(n->queued_packet_list, q);
 	  }
@@ -426,16 +951,16 @@ send_packet(mac_callback_t sent, void *ptr)
 	  }
 	  return;
 	}
-	memb_free(&metadata_memb, q->ptr);
+#if WITH_ORPL && ORPL_WITH_CSMA_STATS
+	stats.queuebuf_failures++;
+#endif /* WITH_ORPL && ORPL_WITH_CSMA_STATS */
+	packet_free(q);
 	PRINTF("csma: could not allocate queuebuf, dropping packet\n");
-      }
-      memb_free(&packet_memb, q);
-      PRINTF("csma: could not allocate queuebuf, dropping packet\n");
     }
     /* The packet allocation failed. Remove and free neighbor entry if empty. */
     if(list_length(n->queued_packet_list) == 0) {
       list_remove(neighbor_list, n);
-      memb_free(&neighbor_memb, n);
+      neighbor_free(n);
     }
     PRINTF("csma: could not allocate packet, dropping packet\n");
     ORPL_LOG_FROM_PACKETBUF("Csma:! couldn't allocate packet");
@@ -479,6 +1004,9 @@ init(void)
   memb_init(&packet_memb);
   memb_init(&metadata_memb);
   memb_init(&neighbor_memb);
+#if CSMA_SHARED_POOL_SIZE > 0
+  memb_init(&shared_memb);
+#endif /* CSMA_SHARED_POOL_SIZE > 0 */
 }
 /*---------------------------------------------------------------------------*/
 const struct mac_driver csma_driver = {
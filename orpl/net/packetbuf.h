@@ -354,6 +354,13 @@ enum {
   PACKETBUF_ATTR_ORPL_DIRECTION,
   PACKETBUF_ATTR_ROUTING_SET,
   PACKETBUF_ATTR_ACKED,
+  PACKETBUF_ATTR_ORPL_TRANSMISSIONS,
+  PACKETBUF_ATTR_ORPL_COLLISIONS,
+  PACKETBUF_ATTR_ORPL_COLLISION_REASON,
+  PACKETBUF_ATTR_ORPL_BROADCAST_CLASS,
+  PACKETBUF_ATTR_ORPL_PRIORITY,
+  PACKETBUF_ATTR_ORPL_DEADLINE,
+  PACKETBUF_ATTR_ORPL_BUDGET,
 #endif /* WITH_ORPL */
 
   /* Scope 1 attributes: used between two neighbors only. */
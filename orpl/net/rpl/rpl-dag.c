@@ -573,6 +573,9 @@ rpl_add_parent(rpl_dag_t *dag, rpl_dio_t *dio, uip_ipaddr_t *addr)
     p->link_metric = RPL_INIT_LINK_METRIC * RPL_DAG_MC_ETX_DIVISOR;
 #if WITH_ORPL
     p->bc_ackcount = 0;
+    p->bc_acked = 0;
+    p->bc_waited = 0;
+    p->bc_count = 0;
 #endif /* WITH_ORPL */
 #if RPL_DAG_MC != RPL_DAG_MC_NONE
     memcpy(&p->mc, &dio->mc, sizeof(p->mc));
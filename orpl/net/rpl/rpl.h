@@ -117,6 +117,9 @@ struct rpl_parent {
   rpl_rank_t rank;
 #if WITH_ORPL
   uint16_t bc_ackcount; /* Broadcast ack count used by ORPL for link estimation */
+  uint8_t bc_acked; /* Set if the neighbor acked the ongoing ORPL broadcast */
+  uint8_t bc_waited; /* Set if the ongoing ORPL broadcast waits for the neighbor's ack */
+  uint16_t bc_count; /* ORPL broadcasts the neighbor had a full chance to ack */
 #endif /* WITH_ORPL */
   uint16_t link_metric;
   uint8_t dtsn;
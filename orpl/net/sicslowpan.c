@@ -66,10 +66,14 @@
 #include "net/rime.h"
 #include "net/sicslowpan.h"
 #include "net/netstack.h"
+#include "lib/random.h"
 #if WITH_ORPL
 #include "orpl.h"
 #include "orpl-routing-set.h"
 #include "orpl-anycast.h"
+#if ORPL_WITH_BROADCAST_CLASSES
+#include "net/uip-icmp6.h"
+#endif /* ORPL_WITH_BROADCAST_CLASSES */
 #endif /* WITH_ORPL */
 
 #if UIP_CONF_IPV6
@@ -1328,6 +1332,9 @@ packet_sent(void *ptr, int status, int transmissions)
   uip_ds6_link_neighbor_callback(status, transmissions);
 
 #if WITH_ORPL
+  if(status == MAC_TX_NOACK) {
+    orpl_noack_callback();
+  }
   if(packetbuf_attr(PACKETBUF_ATTR_ROUTING_SET) == 1) {
     orpl_routing_set_sent(ptr, status, transmissions);
   }
@@ -1371,6 +1378,271 @@ send_packet(rimeaddr_t *dest)
      watchdog know that we are still alive. */
   watchdog_periodic();
 }
+#if WITH_ORPL && ORPL_WITH_AGGREGATION
+/*--------------------------------------------------------------------*/
+/** \name Aggregation of small upward datagrams (ORPL_WITH_AGGREGATION)
+ *
+ * Small datagrams sent upwards wait up to ORPL_AGGREGATION_DELAY for
+ * others, and are sent together in a single frame. The frame starts
+ * with an aggregate dispatch, followed by one entry per datagram: its
+ * length, its ORPL seqno, its transmission budget with
+ * ORPL_WITH_TX_BUDGET, and its compressed 6lowpan datagram. The
+ * receiver inputs the entries one by one, as if received separately.
+ *
+ * The aggregate may take as many transmissions as the entry with the
+ * largest budget. As the frame carries what is left of that budget, the
+ * receiver works out what is left of the budget of every entry.
+ * @{
+ */
+/** Aggregate dispatch, see ORPL_AGGREGATE_DISPATCH */
+#define SICSLOWPAN_DISPATCH_ORPL_AGGREGATE ORPL_AGGREGATE_DISPATCH
+/** Size of an entry header: 8-bit length, 32-bit seqno and, with
+    ORPL_WITH_TX_BUDGET, 8-bit transmission budget */
+#define AGGREGATE_ENTRY_HDR_LEN (5 + ORPL_WITH_TX_BUDGET)
+
+/** The pending aggregate */
+static uint8_t aggregate_buf[MAC_MAX_PAYLOAD];
+static uint8_t aggregate_len;
+static uint8_t aggregate_count;
+static struct ctimer aggregate_timer;
+/** Packetbuf attributes of the first entry, restored when sending, as
+    the flush may happen long after output cleared them */
+static struct packetbuf_attr aggregate_attrs[PACKETBUF_NUM_ATTRS];
+static struct packetbuf_addr aggregate_addrs[PACKETBUF_NUM_ADDRS];
+#if ORPL_WITH_PRIORITY_QUEUEING
+/** Earliest deadline of the entries, 0 for none */
+static uint16_t aggregate_deadline;
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+static void input(void);
+#if ORPL_WITH_TX_BUDGET
+/*--------------------------------------------------------------------*/
+/** \brief Largest transmission budget of the entries of an aggregate */
+static uint8_t
+aggregate_max_budget(uint8_t *buf, uint16_t len)
+{
+  uint8_t budget = 0;
+  uint16_t pos = 1;
+
+  while(pos + AGGREGATE_ENTRY_HDR_LEN <= len) {
+    if(buf[pos + 5] > budget) {
+      budget = buf[pos + 5];
+    }
+    pos += AGGREGATE_ENTRY_HDR_LEN + buf[pos];
+  }
+  return budget;
+}
+#endif /* ORPL_WITH_TX_BUDGET */
+/*--------------------------------------------------------------------*/
+/** \brief Send the pending aggregate, or its only entry as a
+ *  regular frame */
+static void
+aggregate_flush(void *ptr)
+{
+  uint8_t *entry;
+
+  ctimer_stop(&aggregate_timer);
+  if(aggregate_count == 0) {
+    return;
+  }
+
+  packetbuf_clear();
+  packetbuf_attr_copyfrom(aggregate_attrs, aggregate_addrs);
+  if(aggregate_count == 1) {
+    /* Nothing was aggregated, send the datagram as it was */
+    entry = aggregate_buf + 1;
+    memcpy(packetbuf_dataptr(), entry + AGGREGATE_ENTRY_HDR_LEN, entry[0]);
+    packetbuf_set_datalen(entry[0]);
+  } else {
+    /* The aggregate gets a seqno of its own, for duplicate detection
+       at the link layer, from the same space as the seqnos of the
+       datagrams we originate. The entries keep theirs end-to-end. */
+    orpl_packetbuf_set_seqno(orpl_get_new_seqno());
+    /* It has no single destination: csma queues it on its anycast
+       address */
+    packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER, &anycast_addr_up);
+    memcpy(packetbuf_dataptr(), aggregate_buf, aggregate_len);
+    packetbuf_set_datalen(aggregate_len);
+#if ORPL_WITH_TX_BUDGET
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET,
+                       aggregate_max_budget(aggregate_buf, aggregate_len));
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DEADLINE, aggregate_deadline);
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+  }
+
+  PRINTFO("sicslowpan output: sending aggregate of %u datagrams, len %u\n",
+          aggregate_count, packetbuf_datalen());
+  aggregate_len = 0;
+  aggregate_count = 0;
+  send_packet(&anycast_addr_up);
+}
+/*--------------------------------------------------------------------*/
+/** \brief Add the compressed datagram in packetbuf to the pending
+ *  aggregate
+ *  \return 1 if added, 0 if the datagram must be sent on its own */
+static int
+aggregate_add(void)
+{
+  static struct packetbuf_attr attrs[PACKETBUF_NUM_ATTRS];
+  static struct packetbuf_addr addrs[PACKETBUF_NUM_ADDRS];
+  uint8_t len = packetbuf_datalen();
+  uint32_t seqno = orpl_packetbuf_seqno();
+  uint8_t datagram[ORPL_AGGREGATION_MAX_LEN];
+  uint8_t *entry;
+#if ORPL_WITH_PRIORITY_QUEUEING
+  uint16_t deadline;
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+  if(len > ORPL_AGGREGATION_MAX_LEN
+#if ORPL_WITH_PRIORITY_QUEUEING
+     /* Prioritized datagrams are never held back */
+     || packetbuf_attr(PACKETBUF_ATTR_ORPL_PRIORITY) != 0
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+     ) {
+    return 0;
+  }
+
+  if(aggregate_count > 0
+     && aggregate_len + AGGREGATE_ENTRY_HDR_LEN + len > sizeof(aggregate_buf)) {
+    /* No room left. Send the pending aggregate first, for the datagrams
+       to leave in order, and start a new one with this datagram. Sending
+       clears packetbuf, keep the datagram aside. */
+    memcpy(datagram, packetbuf_dataptr(), len);
+    packetbuf_attr_copyto(attrs, addrs);
+    aggregate_flush(NULL);
+    packetbuf_clear();
+    packetbuf_attr_copyfrom(attrs, addrs);
+    memcpy(packetbuf_dataptr(), datagram, len);
+    packetbuf_set_datalen(len);
+  }
+  if(aggregate_count == 0) {
+    aggregate_buf[0] = SICSLOWPAN_DISPATCH_ORPL_AGGREGATE;
+    aggregate_len = 1;
+    /* Give csma the address of the queue the datagram goes to, from
+       uip_buf that still holds it but is reused by the time we send */
+    packetbuf_set_addr(PACKETBUF_ADDR_ERECEIVER,
+                       (const rimeaddr_t *)((uint8_t *)&UIP_IP_BUF->destipaddr + 8));
+    packetbuf_attr_copyto(aggregate_attrs, aggregate_addrs);
+#if ORPL_WITH_PRIORITY_QUEUEING
+    aggregate_deadline = 0;
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+  }
+#if ORPL_WITH_PRIORITY_QUEUEING
+  deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+  if(deadline != 0
+     && (aggregate_deadline == 0 || CLOCK_LT(deadline, aggregate_deadline))) {
+    aggregate_deadline = deadline;
+  }
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+  entry = aggregate_buf + aggregate_len;
+  entry[0] = len;
+  entry[1] = seqno >> 24;
+  entry[2] = seqno >> 16;
+  entry[3] = seqno >> 8;
+  entry[4] = seqno;
+#if ORPL_WITH_TX_BUDGET
+  entry[5] = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+#endif /* ORPL_WITH_TX_BUDGET */
+  memcpy(entry + AGGREGATE_ENTRY_HDR_LEN, packetbuf_dataptr(), len);
+  aggregate_len += AGGREGATE_ENTRY_HDR_LEN + len;
+
+  if(aggregate_count++ == 0) {
+    ctimer_set(&aggregate_timer, ORPL_AGGREGATION_DELAY, aggregate_flush, NULL);
+  }
+  return 1;
+}
+/*--------------------------------------------------------------------*/
+/** \brief Unpack the aggregate in packetbuf and input its entries
+ *
+ *  Each entry is copied back to packetbuf along with the addresses,
+ *  the seqno, the budget and the deadline, that the decompression and
+ *  the IP layer use. This is done before every entry, as forwarding the previous one
+ *  clears packetbuf. */
+static void
+aggregate_input(void)
+{
+  static uint8_t buf[MAC_MAX_PAYLOAD];
+  rimeaddr_t sender;
+  rimeaddr_t receiver;
+  uint8_t *entry;
+  uint8_t len;
+  uint16_t pos;
+  uint32_t seqno;
+#if ORPL_WITH_TX_BUDGET
+  uint8_t budget;
+  /* Transmissions the aggregate took before the one we received */
+  uint8_t spent;
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+  /* The aggregate carries the earliest deadline of its entries */
+  uint16_t deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+  len = packetbuf_datalen();
+  if(len > sizeof(buf)) {
+    return;
+  }
+  memcpy(buf, packetbuf_dataptr(), len);
+#if ORPL_WITH_TX_BUDGET
+  budget = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+  spent = 0;
+  if(budget != 0) {
+    spent = aggregate_max_budget(buf, len);
+    spent = spent > budget ? spent - budget : 0;
+  }
+#endif /* ORPL_WITH_TX_BUDGET */
+  rimeaddr_copy(&sender, packetbuf_addr(PACKETBUF_ADDR_SENDER));
+  rimeaddr_copy(&receiver, packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
+
+  pos = 1;
+  while(pos + AGGREGATE_ENTRY_HDR_LEN <= len) {
+    entry = buf + pos;
+    pos += AGGREGATE_ENTRY_HDR_LEN + entry[0];
+    if(pos > len) {
+      PRINTFI("sicslowpan input: truncated aggregate entry\n");
+      return;
+    }
+    seqno = ((uint32_t)entry[1] << 24) | ((uint32_t)entry[2] << 16)
+        | ((uint32_t)entry[3] << 8) | entry[4];
+
+    /* We may have received the datagram on its own, or in another
+       aggregate: same duplicate detection as contikimac's */
+    if(orpl_app_seqno_contains(seqno)) {
+      PRINTFI("sicslowpan input: duplicate aggregate entry\n");
+      continue;
+    }
+    orpl_app_seqno_insert(seqno);
+
+#if ORPL_WITH_TX_BUDGET
+    if(budget != 0 && entry[5] <= spent) {
+      /* The entry ran out of budget before this transmission */
+      PRINTFI("sicslowpan input: aggregate entry out of budget\n");
+      continue;
+    }
+#endif /* ORPL_WITH_TX_BUDGET */
+
+    packetbuf_clear();
+    packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &sender);
+    packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &receiver);
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DIRECTION, direction_up);
+    orpl_packetbuf_set_seqno(seqno);
+#if ORPL_WITH_TX_BUDGET
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET,
+                       budget != 0 ? entry[5] - spent : 0);
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DEADLINE, deadline);
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+    memcpy(packetbuf_dataptr(), entry + AGGREGATE_ENTRY_HDR_LEN, entry[0]);
+    packetbuf_set_datalen(entry[0]);
+    input();
+  }
+}
+/** @} */
+#endif /* WITH_ORPL && ORPL_WITH_AGGREGATION */
 /*--------------------------------------------------------------------*/
 /** \brief Take an IP packet and format it to be sent on an 802.15.4
  *  network using 6lowpan.
@@ -1392,6 +1664,16 @@ output(uip_lladdr_t *localdest)
   /* Number of bytes processed. */
   uint16_t processed_ip_out_len;
 
+#if WITH_ORPL && ORPL_WITH_TX_BUDGET
+  /* Set in packetbuf by tcpip, that we are about to clear */
+  uint8_t budget = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+#endif /* WITH_ORPL && ORPL_WITH_TX_BUDGET */
+#if WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING
+  /* Same for priority and deadline */
+  uint8_t priority = packetbuf_attr(PACKETBUF_ATTR_ORPL_PRIORITY);
+  uint16_t deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+#endif /* WITH_ORPL && ORPL_WITH_PRIORITY_QUEUEING */
+
   /* init */
   uncomp_hdr_len = 0;
   rime_hdr_len = 0;
@@ -1492,6 +1774,28 @@ output(uip_lladdr_t *localdest)
   } else {
     packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DIRECTION, direction_none);
   }
+  if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) != direction_none) {
+#if ORPL_WITH_TX_BUDGET
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, budget);
+#endif /* ORPL_WITH_TX_BUDGET */
+#if ORPL_WITH_PRIORITY_QUEUEING
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_PRIORITY, priority);
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DEADLINE, deadline);
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+  }
+#if ORPL_WITH_BROADCAST_CLASSES
+  if(localdest == NULL) {
+    /* Classify broadcasts for rate limiting while uip_buf still holds
+     * them. The class is kept in the queuebuf for retransmissions. */
+    if(sending_routing_set) {
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BROADCAST_CLASS, broadcast_class_routing_set);
+    } else if(UIP_IP_BUF->proto == UIP_PROTO_ICMP6 && UIP_ICMP_BUF->type == ICMP6_RPL) {
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BROADCAST_CLASS, broadcast_class_rpl);
+    } else {
+      packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BROADCAST_CLASS, broadcast_class_app);
+    }
+  }
+#endif /* ORPL_WITH_BROADCAST_CLASSES */
 #endif /* WITH_ORPL */
 
 #if WITH_ORPL /* Workaround to avoid fragmented DIOs */
@@ -1615,6 +1919,11 @@ output(uip_lladdr_t *localdest)
     memcpy(rime_ptr + rime_hdr_len, (uint8_t *)UIP_IP_BUF + uncomp_hdr_len,
            uip_len - uncomp_hdr_len);
     packetbuf_set_datalen(uip_len - uncomp_hdr_len + rime_hdr_len);
+#if WITH_ORPL && ORPL_WITH_AGGREGATION
+    if(localdest == (uip_lladdr_t *)&anycast_addr_up && aggregate_add()) {
+      return 1;
+    }
+#endif /* WITH_ORPL && ORPL_WITH_AGGREGATION */
     send_packet(&dest);
   }
   return 1;
@@ -1654,6 +1963,14 @@ input(void)
   /* The MAC puts the 15.4 payload inside the RIME data buffer */
   rime_ptr = packetbuf_dataptr();
 
+#if WITH_ORPL && ORPL_WITH_AGGREGATION
+  if(packetbuf_datalen() > 0 && rime_ptr[0] == SICSLOWPAN_DISPATCH_ORPL_AGGREGATE) {
+    PRINTFI("sicslowpan input: ORPL aggregate\n");
+    aggregate_input();
+    return;
+  }
+#endif /* WITH_ORPL && ORPL_WITH_AGGREGATION */
+
 #if SICSLOWPAN_CONF_FRAG
   /* if reassembly timed out, cancel it */
   if(timer_expired(&reass_timer)) {
@@ -645,8 +645,28 @@ tcpip_ipv6_output(void)
         /* We are originator of the data, get seqno
          * possibly set by application layer */
         seqno = orpl_get_curr_seqno();
+#if ORPL_WITH_PRIORITY_QUEUEING
+        /* Carry the priority possibly set by application layer */
+        orpl_packetbuf_set_priority(1);
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
       } else {
         seqno = orpl_packetbuf_seqno();
+#if ORPL_WITH_FP_CACHE
+        if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_recover) {
+          /* A child we routed the packet down to sent it back: routing
+           * down to its destination failed below us */
+          orpl_fp_cache_report(&UIP_IP_BUF->destipaddr, seqno);
+        }
+#endif /* ORPL_WITH_FP_CACHE */
+#if ORPL_WITH_PRIORITY_QUEUEING
+        /* Keep the priority the packet was received with, and drop it
+         * if its deadline passed on the way */
+        if(!orpl_packetbuf_set_priority(0)) {
+          ORPL_LOG_FROM_UIP("Tcpip:! deadline passed");
+          uip_len = 0;
+          return;
+        }
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
       }
       if(seqno == 0) {
         /* No seqno set, assign a new one
@@ -656,11 +676,24 @@ tcpip_ipv6_output(void)
       }
       orpl_set_curr_seqno(seqno);
 
+#if ORPL_WITH_FP_EXPLORATION
+      if(!orpl_is_reachable_neighbor(&UIP_IP_BUF->destipaddr)
+          && orpl_fp_exploration_done(seqno)) {
+        /* Enough children failed below us, blacklist the packet so that
+         * it climbs */
+        orpl_fp_exploration_end(seqno);
+      }
+#endif /* ORPL_WITH_FP_EXPLORATION */
+
       /* Set anycast MAC address instead of routing */
       if(orpl_is_reachable_neighbor(&UIP_IP_BUF->destipaddr)) {
         ORPL_LOG_FROM_UIP("Tcpip: fw to nbr");
         anycast_addr = &anycast_addr_nbr;
-      } else if(orpl_routing_set_contains(&UIP_IP_BUF->destipaddr) && !orpl_blacklist_contains(seqno)) {
+      } else if(orpl_routing_set_contains(&UIP_IP_BUF->destipaddr) && !orpl_blacklist_contains(seqno)
+#if ORPL_WITH_FP_CACHE
+          && !orpl_fp_cache_contains(&UIP_IP_BUF->destipaddr)
+#endif /* ORPL_WITH_FP_CACHE */
+          ) {
         ORPL_LOG_FROM_UIP("Tcpip: fw down");
         anycast_addr = &anycast_addr_down;
       } else if(orpl_is_root() == 0){
@@ -687,6 +720,14 @@ tcpip_ipv6_output(void)
     	  return;
       }
       if(anycast_addr == &anycast_addr_up || anycast_addr == &anycast_addr_down || anycast_addr == &anycast_addr_nbr) {
+#if ORPL_WITH_TX_BUDGET
+    	  if(!orpl_packetbuf_set_budget(uip_ds6_is_my_addr(&UIP_IP_BUF->srcipaddr))) {
+    	    /* Drop silently, an ICMPv6 error would cost more transmissions */
+    	    ORPL_LOG_FROM_UIP("Tcpip:! transmission budget spent");
+    	    uip_len = 0;
+    	    return;
+    	  }
+#endif /* ORPL_WITH_TX_BUDGET */
     	  tcpip_output((uip_lladdr_t *)anycast_addr);
     	  uip_len = 0;
     	  return;
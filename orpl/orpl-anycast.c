@@ -42,7 +42,7 @@
 #include "orpl-routing-set.h"
 #include "orpl-anycast.h"
 #include "net/packetbuf.h"
-#include "cc2420-softack.h"
+#include "softack.h"
 #include "net/mac/frame802154.h"
 #include "dev/leds.h"
 #include <string.h>
@@ -63,6 +63,27 @@ static void orpl_softack_input_callback(const uint8_t *buf, uint8_t len, uint8_t
 static unsigned char ackbuf[3 + EXTRA_ACK_LEN] = {0x02, 0x00};
 /* Seqno of the last acked frame */
 static uint8_t last_acked_seqno = -1;
+/* Set if we decided to ack the last incoming frame, i.e. it is for us */
+static volatile uint8_t last_input_acked = 0;
+#if ORPL_WITH_RI_PROBES
+/* EDC of the last prober heard, 0xffff if none */
+static volatile rpl_rank_t last_probe_edc = 0xffff;
+#endif /* ORPL_WITH_RI_PROBES */
+
+/* Length of the contikimac header, that carries the transmission budget
+ * with ORPL_WITH_TX_BUDGET, the priority and remaining lifetime with
+ * ORPL_WITH_PRIORITY_QUEUEING, and last the forwarder a burst is pinned to
+ * with ORPL_WITH_BURST, see contikimac-orpl.c */
+#define CONTIKIMAC_HDR_LEN (CONTIKIMAC_CONF_WITH_CONTIKIMAC_HEADER ? \
+    2 + ORPL_WITH_TX_BUDGET + 3 * ORPL_WITH_PRIORITY_QUEUEING + 8 * ORPL_WITH_BURST : 0)
+
+/* Offset of the 6lowpan payload of an anycast data frame: 802.15.4 header
+ * with a compressed PAN ID and long addresses, then the contikimac header */
+#define ANYCAST_PAYLOAD_OFFSET (3 + 2 + 8 + 8 + CONTIKIMAC_HDR_LEN)
+#if ORPL_WITH_BURST
+/* Offset of the burst receiver, at the end of the contikimac header */
+#define ANYCAST_BURST_RECEIVER_OFFSET (ANYCAST_PAYLOAD_OFFSET - 8)
+#endif /* ORPL_WITH_BURST */
 
 /* Set the destination link-layer address in packetbuf in case of anycast.
  * The address contains the following information:
@@ -107,6 +128,15 @@ orpl_softack_input_callback(const uint8_t *frame, uint8_t framelen, uint8_t **ac
 	ack_required = (fcf >> 5) & 1;
 	seqno = frame[2];
 
+#if ORPL_WITH_RI_PROBES
+	{
+		rpl_rank_t probe_edc;
+		if(orpl_anycast_probe_parse(frame, framelen, &probe_edc)) {
+			last_probe_edc = probe_edc;
+		}
+	}
+#endif /* ORPL_WITH_RI_PROBES */
+
 	if(is_data) {
 		if(ack_required) { /* This is unicast or unicast, parse it */
 			do_ack = orpl_anycast_802154_frame_must_ack((uint8_t *)frame, framelen);
@@ -118,6 +148,8 @@ orpl_softack_input_callback(const uint8_t *frame, uint8_t framelen, uint8_t **ac
 		}
 	}
 
+	last_input_acked = do_ack;
+
 	if(do_ack) { /* Prepare ack */
 	  rpl_rank_t curr_edc = orpl_current_edc();
 		*ackbufptr = ackbuf;
@@ -128,6 +160,10 @@ orpl_softack_input_callback(const uint8_t *frame, uint8_t framelen, uint8_t **ac
 		/* Append our rank to the ack */
 		ackbuf[3+8] = curr_edc & 0xff;
 		ackbuf[3+8+1] = (curr_edc >> 8)& 0xff;
+#if ORPL_WITH_ADAPTIVE_CYCLE
+		/* Append our channel check level to the ack */
+		ackbuf[3+8+2] = contikimac_cycle_level;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
 	} else {
 		*acklen = 0;
 	}
@@ -251,14 +287,29 @@ orpl_anycast_802154_frame_must_ack(uint8_t *data, uint8_t len)
     /* Parse the destination address */
     if(anycast_parse_addr((rimeaddr_t*)dest_addr, &info.direction, &info.neighbor_edc, &info.seqno)) {
       rpl_rank_t curr_edc = orpl_current_edc();
+      uint16_t edc_w = orpl_edc_w();
+#if ORPL_WITH_BURST
+      if(len > ANYCAST_PAYLOAD_OFFSET) {
+        const rimeaddr_t *burst_receiver = (const rimeaddr_t *)(data + ANYCAST_BURST_RECEIVER_OFFSET);
+        if(!rimeaddr_cmp(burst_receiver, &rimeaddr_null)
+            && !rimeaddr_cmp(burst_receiver, &rimeaddr_node_addr)) {
+          /* Within a burst pinned to another forwarder */
+          return 0;
+        }
+      }
+#endif /* ORPL_WITH_BURST */
+      /* An aggregate of upward datagrams has no single destination,
+       * and none at the fixed offset below. Only its EDC counts. */
+      int is_aggregate = ORPL_WITH_AGGREGATION && len > ANYCAST_PAYLOAD_OFFSET
+          && data[ANYCAST_PAYLOAD_OFFSET] == ORPL_AGGREGATE_DISPATCH;
 
       /* Calculate destination IPv6 address */
       /* TODO ORPL: better document this addressing */
       uip_ipaddr_t dest_ipv6;
       memcpy(&dest_ipv6, &global_ipv6, 8); /* override prefix */
-      memcpy(((char*)&dest_ipv6)+8, data + (CONTIKIMAC_CONF_WITH_CONTIKIMAC_HEADER ? 2 : 0) + 34, 8);
+      memcpy(((char*)&dest_ipv6)+8, data + CONTIKIMAC_HDR_LEN + 34, 8);
 
-      if(uip_ip6addr_cmp(&dest_ipv6, &global_ipv6)) {
+      if(!is_aggregate && uip_ip6addr_cmp(&dest_ipv6, &global_ipv6)) {
         /* Take the data if it is for us */
         do_ack = 1;
       } else if(rimeaddr_cmp((rimeaddr_t*)dest_addr_host_order, &rimeaddr_node_addr)) {
@@ -266,24 +317,32 @@ orpl_anycast_802154_frame_must_ack(uint8_t *data, uint8_t len)
         do_ack = 1;
       } else if(info.direction == direction_up) {
         /* Routing upwards. ACK if our rank is better. */
-        if(info.neighbor_edc > ORPL_EDC_W && curr_edc < info.neighbor_edc - ORPL_EDC_W) {
+        if(info.neighbor_edc > edc_w && curr_edc < info.neighbor_edc - edc_w) {
           do_ack = 1;
-        } else {
+        } else if(!is_aggregate) {
           /* We don't route upwards, now check if we are a common ancester of the source
            * and destination. We do this by checking our routing set against the destination. */
-          if(!orpl_blacklist_contains(info.seqno) && orpl_routing_set_contains(&dest_ipv6)) {
+          if(!orpl_blacklist_contains(info.seqno) && orpl_routing_set_contains(&dest_ipv6)
+#if ORPL_WITH_FP_CACHE
+              && !orpl_fp_cache_contains(&dest_ipv6)
+#endif /* ORPL_WITH_FP_CACHE */
+              ) {
             /* Traffic is going up but we have destination in our routing set.
              * Ack it and start routing downwards (towards the destination) */
             do_ack = 1;
           }
         }
-      } else if(info.direction == direction_down) {
+      } else if(info.direction == direction_down && !is_aggregate) {
         /* Routing downwards. ACK if destination is reachable neighbor or
          * we it is in subdodag and we have a worse rank */
         if(!orpl_blacklist_contains(info.seqno)
             && (orpl_is_reachable_neighbor(&dest_ipv6)
-                || (curr_edc > ORPL_EDC_W && curr_edc - ORPL_EDC_W > info.neighbor_edc
-                && orpl_routing_set_contains(&dest_ipv6)))) {
+                || (curr_edc > edc_w && curr_edc - edc_w > info.neighbor_edc
+                && orpl_routing_set_contains(&dest_ipv6)
+#if ORPL_WITH_FP_CACHE
+                && !orpl_fp_cache_contains(&dest_ipv6)
+#endif /* ORPL_WITH_FP_CACHE */
+                ))) {
           do_ack = 1;
         }
       } else if(info.direction == direction_recover) {
@@ -300,12 +359,63 @@ orpl_anycast_802154_frame_must_ack(uint8_t *data, uint8_t len)
   return do_ack;
 }
 
+/* Returns 1 if we decided to ack the last incoming frame */
+int
+orpl_anycast_last_input_acked()
+{
+  return last_input_acked;
+}
+
+/* Forget the ack decision of the last incoming frame */
+void
+orpl_anycast_clear_last_input_acked()
+{
+  last_input_acked = 0;
+}
+
+#if ORPL_WITH_RI_PROBES
+/* Write a probe to buf, of size RI_PROBE_LEN */
+void
+orpl_anycast_build_probe(uint8_t *buf, uint8_t seqno)
+{
+  rpl_rank_t curr_edc = orpl_current_edc();
+  buf[0] = FRAME802154_CMDFRAME; /* No ack request, no addressing fields */
+  buf[1] = 0x00;
+  buf[2] = seqno;
+  buf[3] = RI_PROBE_CMD_ID;
+  rimeaddr_copy((rimeaddr_t*)(buf+4), &rimeaddr_node_addr);
+  buf[4+8] = curr_edc & 0xff;
+  buf[4+8+1] = (curr_edc >> 8) & 0xff;
+}
+
+/* Returns 1 if the frame is a probe, and sets edc to the prober's EDC */
+int
+orpl_anycast_probe_parse(const uint8_t *data, uint8_t len, rpl_rank_t *edc)
+{
+  if(len < RI_PROBE_LEN || data[0] != FRAME802154_CMDFRAME
+      || data[1] != 0x00 || data[3] != RI_PROBE_CMD_ID) {
+    return 0;
+  }
+  *edc = (data[4+8+1] << 8) + data[4+8];
+  return 1;
+}
+
+/* Returns the EDC of the last prober heard since the previous call, 0xffff if none */
+rpl_rank_t
+orpl_anycast_last_probe_edc()
+{
+  rpl_rank_t edc = last_probe_edc;
+  last_probe_edc = 0xffff;
+  return edc;
+}
+#endif /* ORPL_WITH_RI_PROBES */
+
 /* Anycast-specific inits */
 void
 orpl_anycast_init()
 {
   /* Subscribe to 802.15.4 softack driver */
-  cc2420_softack_subscribe(orpl_softack_input_callback, orpl_softack_acked_callback);
+  SOFTACK_DRIVER.subscribe(orpl_softack_input_callback, orpl_softack_acked_callback);
 }
 
 #endif /* WITH_ORPL */
@@ -42,8 +42,13 @@
 #define __ORPL_ANYCAST_H__
 
 #include "uip.h"
+#include "orpl.h"
 
+#if ORPL_WITH_ADAPTIVE_CYCLE
+#define EXTRA_ACK_LEN    11 /* Number of bytes we add to standard IEEE 802.15.4 ACK frames */
+#else /* ORPL_WITH_ADAPTIVE_CYCLE */
 #define EXTRA_ACK_LEN    10 /* Number of bytes we add to standard IEEE 802.15.4 ACK frames */
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
 
 /* The different link-layer addresses used for anycast */
 extern rimeaddr_t anycast_addr_up;
@@ -51,6 +56,11 @@ extern rimeaddr_t anycast_addr_down;
 extern rimeaddr_t anycast_addr_nbr;
 extern rimeaddr_t anycast_addr_recover;
 
+#if ORPL_WITH_ADAPTIVE_CYCLE
+/* Our current channel check level, advertised in ACKs. Set by contikimac-orpl.c */
+extern volatile uint8_t contikimac_cycle_level;
+#endif /* ORPL_WITH_ADAPTIVE_CYCLE */
+
 enum anycast_direction_e {
   direction_none,
   direction_up,
@@ -59,6 +69,25 @@ enum anycast_direction_e {
   direction_recover
 };
 
+/* Reasons for a MAC_TX_COLLISION, set in PACKETBUF_ATTR_ORPL_COLLISION_REASON */
+enum collision_reason_e {
+  collision_none,
+  collision_rx_for_us, /* We are receiving a frame destined to us */
+  collision_rx_foreign, /* We are receiving a frame not for us */
+  collision_rx_burst, /* We are receiving a burst */
+  collision_channel_busy, /* CCA detected foreign traffic */
+  collision_rate_limit /* Broadcast rate limit */
+};
+
+/* Classes of broadcasts, for per-class rate limiting (see
+ * ORPL_WITH_BROADCAST_CLASSES). Set in PACKETBUF_ATTR_ORPL_BROADCAST_CLASS */
+enum broadcast_class_e {
+  broadcast_class_app,
+  broadcast_class_rpl,
+  broadcast_class_routing_set
+};
+#define ORPL_BROADCAST_CLASSES (broadcast_class_routing_set + 1)
+
 struct anycast_parsing_info {
   enum anycast_direction_e direction;
   uint16_t neighbor_edc;
@@ -71,6 +100,23 @@ void orpl_anycast_set_packetbuf_addr();
 struct anycast_parsing_info orpl_anycast_802154_frame_parse(uint8_t *data, uint8_t len);
 /* Parse a modified 802.15.4 frame and decides whether to ack it or not */
 int orpl_anycast_802154_frame_must_ack(uint8_t *data, uint8_t len);
+/* Returns 1 if we decided to ack the last incoming frame */
+int orpl_anycast_last_input_acked();
+/* Forget the ack decision of the last incoming frame */
+void orpl_anycast_clear_last_input_acked();
+
+#if ORPL_WITH_RI_PROBES
+/* Probes are 802.15.4 MAC command frames with no addressing fields,
+ * carrying the address and EDC of the prober */
+#define RI_PROBE_CMD_ID  0xf0
+#define RI_PROBE_LEN     14
+/* Write a probe to buf, of size RI_PROBE_LEN */
+void orpl_anycast_build_probe(uint8_t *buf, uint8_t seqno);
+/* Returns 1 if the frame is a probe, and sets edc to the prober's EDC */
+int orpl_anycast_probe_parse(const uint8_t *data, uint8_t len, rpl_rank_t *edc);
+/* Returns the EDC of the last prober heard since the previous call, 0xffff if none */
+rpl_rank_t orpl_anycast_last_probe_edc();
+#endif /* ORPL_WITH_RI_PROBES */
 /* Anycast-specific inits */
 void orpl_anycast_init();
 
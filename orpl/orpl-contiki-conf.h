@@ -71,14 +71,20 @@
 #undef UIP_CONF_MAX_ROUTES
 #define UIP_CONF_MAX_ROUTES  0
 
-/* ORPL is not compatible with ContikiMAC phase-lock */
+/* ORPL is not compatible with ContikiMAC phase-lock, as anycast has no
+ * single receiver. See ORPL_CONF_WITH_PHASE_TRACKER instead. */
 #undef CONTIKIMAC_CONF_WITH_PHASE_OPTIMIZATION
 #define CONTIKIMAC_CONF_WITH_PHASE_OPTIMIZATION 0
 
-/* ORPL is not compatible with sending bursts, we therefore
- * set the number of CCA before transmitting to 2 only */
+/* When ORPL does not send bursts, we set the number of CCA before
+ * transmitting to 2 only. With bursts, keep the default so that we
+ * do not interrupt bursts from our neighbors. */
 #undef CONTIKIMAC_CONF_CCA_COUNT_MAX_TX
+#if ORPL_CONF_WITH_BURST
+#define CONTIKIMAC_CONF_CCA_COUNT_MAX_TX 6
+#else /* ORPL_CONF_WITH_BURST */
 #define CONTIKIMAC_CONF_CCA_COUNT_MAX_TX 2 /* default 6 */
+#endif /* ORPL_CONF_WITH_BURST */
 
 /* Our softack implementation for cc2420 requires to disable DCO synch */
 #undef DCOSYNCH_CONF_ENABLED
@@ -96,9 +102,15 @@
 #undef NETSTACK_CONF_RDC
 #define NETSTACK_CONF_RDC     contikimac_orpl_driver
 
-/* Contiki netstack: RADIO */
+/* Contiki netstack: RADIO, along with the matching softack driver */
 #undef NETSTACK_CONF_RADIO
+#if CONTIKI_TARGET_NATIVE
+#define NETSTACK_CONF_RADIO   native_softack_driver
+#define SOFTACK_CONF_DRIVER   native_softack
+#else /* CONTIKI_TARGET_NATIVE */
 #define NETSTACK_CONF_RADIO   cc2420_softack_driver
+#define SOFTACK_CONF_DRIVER   cc2420_softack
+#endif /* CONTIKI_TARGET_NATIVE */
 
 /* ORPL Callbacks for cc2420 softacks */
 #define SOFTACK_ACKED_CALLBACK orpl_softack_acked_callback
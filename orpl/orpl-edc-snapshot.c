@@ -0,0 +1,152 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Computation of EDC from a snapshot of its inputs. The core of the
+ *         forwarder set selection (orpl_edc_tentative) is shared with
+ *         orpl_calculate_edc, so that a snapshot replays exactly.
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#include "orpl-edc-snapshot.h"
+#include <stdio.h>
+
+/* Tries to add a neighbor to the forwarder set. Updates the ackcount sums and
+ * returns the resulting EDC */
+uint16_t
+orpl_edc_tentative(uint16_t hbh_edc, uint32_t broadcast_count, uint16_t edc_w,
+    uint16_t rank, uint16_t ackcount,
+    uint32_t *ackcount_sum, uint32_t *ackcount_edc_sum, int verbose)
+{
+  uint16_t tentative_edc;
+  uint32_t total_tx_count;
+
+  if(ackcount > broadcast_count) {
+    ackcount = broadcast_count;
+  }
+
+  total_tx_count = broadcast_count;
+  if(total_tx_count == 0) {
+    /* No broadcast sent yet: assume a reception rate of 50% */
+    ackcount = 1;
+    total_tx_count = 2;
+  }
+
+  *ackcount_sum += ackcount;
+  *ackcount_edc_sum += (uint32_t)ackcount * rank;
+
+  /* The two main components of EDC: A, the cost of forwarding to any
+   * parent, B the weighted mean EDC of the forwarder set */
+  uint32_t A = hbh_edc * total_tx_count / *ackcount_sum;
+  uint32_t B = *ackcount_edc_sum / *ackcount_sum;
+  if(verbose) {
+    printf("-- A: %5lu, B: %5lu (%u/%lu) ",
+        (unsigned long)A,
+        (unsigned long)B,
+        ackcount,
+        (unsigned long)total_tx_count
+    );
+  }
+
+  /* Finally add W to EDC (cost of forwarding) */
+  tentative_edc = A + B + edc_w;
+
+  if(verbose) {
+    printf("EDC %5u ", tentative_edc);
+  }
+
+  return tentative_edc;
+}
+
+/* Computes EDC from a snapshot, the same way orpl_calculate_edc does from
+ * the neighbor table. Sets *forwarder_set_size if non-NULL. */
+uint16_t
+orpl_edc_snapshot_calculate(const struct orpl_edc_snapshot *s,
+    uint8_t *forwarder_set_size, int verbose)
+{
+  uint16_t edc = 0xffff;
+  uint32_t ackcount_sum = 0;
+  uint32_t ackcount_edc_sum = 0;
+  uint8_t fs_size = 0;
+  int i, curr;
+  int prev_index = -1;
+  uint16_t prev_min_rank = 0;
+
+  /* Loop over the neighbors ordered by increasing rank (ties broken by
+   * neighbor table order), try to insert them in the forwarder set */
+  do {
+    curr = -1;
+    for(i = 0; i < s->count; i++) {
+      uint16_t rank = s->nbr[i].rank;
+      uint16_t ackcount = s->nbr[i].ackcount;
+
+      if(rank != 0xffff
+          && !(s->broadcast_count > 0 && ackcount == 0)
+          && (curr == -1 || rank < s->nbr[curr].rank)
+          && (rank > prev_min_rank || (rank == prev_min_rank && i > prev_index))
+      ) {
+        curr = i;
+      }
+    }
+
+    if(curr != -1) {
+      uint16_t tentative_edc;
+
+      if(verbose) {
+        printf("EDC -> node %3u rank: %5u ack %u/%lu ", s->nbr[curr].id,
+            s->nbr[curr].rank, s->nbr[curr].ackcount, (unsigned long)s->broadcast_count);
+      }
+
+      tentative_edc = orpl_edc_tentative(s->hbh_edc, s->broadcast_count, s->edc_w,
+          s->nbr[curr].rank, s->nbr[curr].ackcount,
+          &ackcount_sum, &ackcount_edc_sum, verbose);
+
+      if(tentative_edc < edc) {
+        edc = tentative_edc;
+        fs_size++;
+        if(verbose) {
+          printf("*\n");
+        }
+      } else if(verbose) {
+        printf("\n");
+      }
+      prev_index = curr;
+      prev_min_rank = s->nbr[curr].rank;
+    }
+  } while(curr != -1);
+
+  if(forwarder_set_size != NULL) {
+    *forwarder_set_size = fs_size;
+  }
+  return edc;
+}
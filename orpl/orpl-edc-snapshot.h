@@ -0,0 +1,86 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Snapshots of the inputs of the EDC computation, and a computation of
+ *         EDC from a snapshot. This file has no dependency on Contiki, so that
+ *         it can be used both in ORPL and in host tools (see tools/edc-replay.c).
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#ifndef __ORPL_EDC_SNAPSHOT_H__
+#define __ORPL_EDC_SNAPSHOT_H__
+
+#include <stdint.h>
+
+/* Version of the snapshot serialization format */
+#define ORPL_EDC_SNAPSHOT_VERSION 1
+
+/* Maximum number of neighbors in a snapshot */
+#define ORPL_EDC_SNAPSHOT_MAX_NBR 64
+
+/* Serialization format, little-endian, as dumped in hex by orpl-log:
+ * version (1), node id (2), edc (2), hbh_edc (2), edc_w (2),
+ * broadcast count (4), nbr count (1), then for every neighbor,
+ * in neighbor table order: id (2), rank (2), ackcount (2) */
+#define ORPL_EDC_SNAPSHOT_HEADER_LEN 14
+#define ORPL_EDC_SNAPSHOT_NBR_LEN 6
+
+struct orpl_edc_snapshot_nbr {
+  uint16_t id;
+  uint16_t rank;
+  uint16_t ackcount;
+};
+
+/* All inputs of the EDC computation, along with the resulting EDC */
+struct orpl_edc_snapshot {
+  uint16_t node_id;
+  uint16_t edc;
+  uint16_t hbh_edc;
+  uint16_t edc_w;
+  uint32_t broadcast_count;
+  uint8_t count;
+  struct orpl_edc_snapshot_nbr nbr[ORPL_EDC_SNAPSHOT_MAX_NBR];
+};
+
+/* Tries to add a neighbor to the forwarder set. Updates the ackcount sums and
+ * returns the resulting EDC */
+uint16_t orpl_edc_tentative(uint16_t hbh_edc, uint32_t broadcast_count, uint16_t edc_w,
+    uint16_t rank, uint16_t ackcount,
+    uint32_t *ackcount_sum, uint32_t *ackcount_edc_sum, int verbose);
+/* Computes EDC from a snapshot, the same way orpl_calculate_edc does from
+ * the neighbor table. Sets *forwarder_set_size if non-NULL. */
+uint16_t orpl_edc_snapshot_calculate(const struct orpl_edc_snapshot *s,
+    uint8_t *forwarder_set_size, int verbose);
+
+#endif /* __ORPL_EDC_SNAPSHOT_H__ */
@@ -43,7 +43,9 @@
 #include "net/uip-debug.h"
 #include "orpl.h"
 #include "orpl-anycast.h"
+#include "orpl-edc-snapshot.h"
 #include "packetbuf.h"
+#include "net/mac/mac.h"
 
 #if WITH_ORPL
 
@@ -71,6 +73,11 @@ rpl_of_t rpl_of_edc = {
 /* Current hop-by-hop EDC, which is the expected strobe duration before getting
  * an ack from a parent. We maintain this as a moving average. */
 static uint16_t hbh_edc = EDC_DIVISOR;
+/* Hop-by-hop EDC of downwards and neighbor traffic, i.e. the average strobe
+ * duration before getting an ack from a child (resp. the destination neighbor).
+ * Not part of the metric, but used to estimate the cost of routing downwards. */
+static uint16_t hbh_edc_down = EDC_DIVISOR;
+static uint16_t hbh_edc_nbr = EDC_DIVISOR;
 
 /* The size of the forwarder set and neighbor set.
  * Both are needed in some other parts of ORPL. */
@@ -82,44 +89,8 @@ static int
 add_to_forwarder_set(rpl_parent_t *curr_p, rpl_rank_t curr_p_rank, uint16_t ackcount,
     uint32_t *curr_ackcount_sum, uint32_t *curr_ackcount_edc_sum, int verbose)
 {
-  uint16_t tentative_edc;
-  uint32_t total_tx_count;
-
-  if(ackcount > orpl_broadcast_count) {
-    ackcount = orpl_broadcast_count;
-  }
-
-  total_tx_count = orpl_broadcast_count;
-  if(total_tx_count == 0) {
-    /* No broadcast sent yet: assume a reception rate of 50% */
-    ackcount = 1;
-    total_tx_count = 2;
-  }
-
-  *curr_ackcount_sum += ackcount;
-  *curr_ackcount_edc_sum += ackcount * curr_p_rank;
-
-  /* The two main components of EDC: A, the cost of forwarding to any
-   * parent, B the weighted mean EDC of the forwarder set */
-  uint32_t A = hbh_edc * total_tx_count / *curr_ackcount_sum;
-  uint32_t B = *curr_ackcount_edc_sum / *curr_ackcount_sum;
-  if(verbose) {
-    printf("-- A: %5lu, B: %5lu (%u/%lu) ",
-        A,
-        B,
-        ackcount,
-        total_tx_count
-    );
-  }
-
-  /* Finally add W to EDC (cost of forwarding) */
-  tentative_edc = A + B + ORPL_EDC_W;
-
-  if(verbose) {
-    printf("EDC %5u ", tentative_edc);
-  }
-
-  return tentative_edc;
+  return orpl_edc_tentative(hbh_edc, orpl_broadcast_count, orpl_edc_w(),
+      curr_p_rank, ackcount, curr_ackcount_sum, curr_ackcount_edc_sum, verbose);
 }
 
 /* Function that computes the metric EDC */
@@ -152,7 +123,8 @@ orpl_calculate_edc(int verbose)
   forwarder_set_size = 0;
 
   if(verbose) {
-    printf("ORPL: starting EDC calculation. hbh_edc: %u, e2e_edc %u\n", hbh_edc, orpl_current_edc());
+    printf("ORPL: starting EDC calculation. hbh_edc: %u (down %u, nbr %u), e2e_edc %u\n",
+        hbh_edc, hbh_edc_down, hbh_edc_nbr, orpl_current_edc());
   }
 
   /* Loop over the parents ordered by increasing rank, try to insert
@@ -167,7 +139,7 @@ orpl_calculate_edc(int verbose)
         p != NULL;
         p = nbr_table_next(rpl_parents, p), index++) {
       uint16_t rank = p->rank;
-      uint16_t ackcount = p->bc_ackcount;
+      uint16_t ackcount = orpl_broadcast_ackcount(p);
 
       if(rank != 0xffff
           && !(orpl_broadcast_count > 0 && ackcount == 0)
@@ -226,39 +198,147 @@ orpl_calculate_edc(int verbose)
   return edc;
 }
 
+/* Returns the current hop-by-hop EDC for a given anycast direction */
+uint16_t
+orpl_hbh_edc(uint8_t direction)
+{
+  switch(direction) {
+  case direction_down:
+  case direction_recover:
+    return hbh_edc_down;
+  case direction_nbr:
+    return hbh_edc_nbr;
+  default:
+    return hbh_edc;
+  }
+}
+
+/* Returns an estimate of the EDC for routing downwards, from us to a node of
+ * EDC dest_edc. The downward path is approximated as the reverse of the upward
+ * one, with every hop weighted by the ratio of down to up hop-by-hop EDC. */
+rpl_rank_t
+orpl_downward_edc(rpl_rank_t dest_edc)
+{
+  rpl_rank_t curr_edc = orpl_current_edc();
+  /* hbh_edc is weighted by the forwarder set size, hbh_edc_down is not */
+  uint16_t hbh_edc_up = forwarder_set_size > 0 ? hbh_edc / forwarder_set_size : hbh_edc;
+  uint32_t edc;
+
+  if(dest_edc == 0xffff || curr_edc == 0xffff) {
+    return 0xffff;
+  }
+  if(dest_edc <= curr_edc) {
+    /* The destination is not below us, we can only estimate a single hop */
+    return hbh_edc_down;
+  }
+
+  edc = (uint32_t)(dest_edc - curr_edc) * hbh_edc_down / (hbh_edc_up > 0 ? hbh_edc_up : 1);
+  return edc < 0xffff ? edc : 0xffff;
+}
+
+/* Returns the hop-by-hop EDC sample for the transmission in packetbuf, and sets
+ * *weight to the number of moving average updates it accounts for (0: no sample).
+ * PACKETBUF_ATTR_EDC is the strobe duration accumulated over the CSMA attempts
+ * counted in PACKETBUF_ATTR_ORPL_TRANSMISSIONS, i.e. all but those that ended
+ * in a collision, which are counted apart and contribute nothing. When ACKed,
+ * it is the actual cost. When not ACKed, the cost of a single attempt is only
+ * a lower bound: we add one cycle to it, and apply it once per failed
+ * transmission, so that repeated failures converge fast. */
+static uint16_t
+get_hbh_edc_sample(int status, uint8_t *weight)
+{
+  uint32_t sample = packetbuf_attr(PACKETBUF_ATTR_EDC);
+  uint8_t transmissions = packetbuf_attr(PACKETBUF_ATTR_ORPL_TRANSMISSIONS);
+  uint8_t collisions = packetbuf_attr(PACKETBUF_ATTR_ORPL_COLLISIONS);
+
+  *weight = 0;
+  if(status == MAC_TX_OK) {
+    *weight = 1;
+  } else if(status == MAC_TX_NOACK) {
+    if(transmissions == 0) {
+      /* Cannot happen, csma counts the NOACK we are called for */
+      transmissions = 1;
+    }
+    sample = sample / transmissions + EDC_DIVISOR;
+    *weight = transmissions;
+  }
+  PRINTF("ORPL: hbh_edc sample %lu, weight %u, status %d, tx %u, collisions %u\n",
+      sample, *weight, status, transmissions, collisions);
+  return sample < 0xffff ? sample : 0xffff;
+}
+
+/* Update a hop-by-hop EDC moving average with a sample, weight times */
+static void
+update_hbh_edc_average(uint16_t *hbh, uint32_t sample, uint8_t weight)
+{
+  uint32_t avg = *hbh;
+  while(weight-- > 0) {
+    avg = ((avg * EDC_ALPHA) + (sample * (EDC_SCALE-EDC_ALPHA))) / EDC_SCALE;
+  }
+  *hbh = avg < 0xffff ? avg : 0xffff;
+}
+
 static void
 reset(rpl_dag_t *sag)
 {
   PRINTF("ORPL: reset EDC\n");
   hbh_edc = EDC_DIVISOR;
+  hbh_edc_down = EDC_DIVISOR;
+  hbh_edc_nbr = EDC_DIVISOR;
   forwarder_set_size = 0;
 }
 
-/* Called after transmitting to a neighbor */
-static void
-neighbor_link_callback(rpl_parent_t *parent, int known, int edc)
+/* Update the hop-by-hop EDC estimates after a transmission. Returns 1 if
+ * the metric (upwards hop-by-hop EDC) was updated. */
+static int
+update_hbh_edc(int status)
 {
+  uint8_t direction = packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION);
+  uint8_t weight;
+  uint16_t curr_hbh_edc = get_hbh_edc_sample(status, &weight);
+
+  if(weight == 0) {
+    return 0;
+  }
+
+  /* Downwards, recovery and neighbor traffic do not contribute to the metric, but
+   * we keep track of their cost, as an estimate of the latency when routing downwards.
+   * Recovery is accounted as downwards traffic, as it is part of the process. */
+  if(direction == direction_down || direction == direction_recover) {
+    update_hbh_edc_average(&hbh_edc_down, curr_hbh_edc, weight);
+    PRINTF("ORPL: updated hbh_edc_down %u (%u)\n", hbh_edc_down, curr_hbh_edc);
+  } else if(direction == direction_nbr) {
+    update_hbh_edc_average(&hbh_edc_nbr, curr_hbh_edc, weight);
+    PRINTF("ORPL: updated hbh_edc_nbr %u (%u)\n", hbh_edc_nbr, curr_hbh_edc);
+  }
+
   /* First check if we are allowed to change rank */
   if(orpl_is_edc_frozen()) {
-    return;
+    return 0;
   }
   /* Calculate the average hop-by-hop EDC, i.e. the average strobe time
-   * required before getting our anycast ACKed. We compute this only for
-   * upwards traffic, as the metric and the topology are directed to the root */
-  if(packetbuf_attr(PACKETBUF_ATTR_ORPL_DIRECTION) == direction_up) {
-    uint16_t curr_hbh_edc = packetbuf_attr(PACKETBUF_ATTR_EDC); /* The strobe time for this packet */
-    uint16_t weighted_curr_hbh_edc;
+   * required before getting our anycast ACKed. Only upwards traffic
+   * contributes to the metric, as the metric and the topology are directed to the root */
+  if(direction == direction_up) {
+    uint32_t weighted_curr_hbh_edc = (uint32_t)curr_hbh_edc * forwarder_set_size;
     uint16_t hbh_edc_prev = hbh_edc;
-    if(curr_hbh_edc == 0xffff) { /* This was NOACK, use a more aggressive alpha (of 50%) */
-      weighted_curr_hbh_edc = EDC_DIVISOR * 2 * forwarder_set_size;
-      hbh_edc = (hbh_edc_prev * (EDC_SCALE/2) + weighted_curr_hbh_edc * (EDC_SCALE/2)) / EDC_SCALE;
-    } else {
-      weighted_curr_hbh_edc = curr_hbh_edc * forwarder_set_size;
-      hbh_edc = ((hbh_edc_prev * EDC_ALPHA) + (weighted_curr_hbh_edc * (EDC_SCALE-EDC_ALPHA))) / EDC_SCALE;
-    }
+    update_hbh_edc_average(&hbh_edc, weighted_curr_hbh_edc, weight);
 
-    PRINTF("ORPL: updated hbh_edc %u -> %u (%u %u)\n", hbh_edc_prev, hbh_edc, curr_hbh_edc, weighted_curr_hbh_edc);
+    PRINTF("ORPL: updated hbh_edc %u -> %u (%u %lu)\n", hbh_edc_prev, hbh_edc, curr_hbh_edc, weighted_curr_hbh_edc);
+    return 1;
+  }
+  return 0;
+}
 
+/* Called after transmitting to a neighbor. NOACKs are not reported here, as
+ * the receiver of an unacked anycast is not a parent; see orpl_noack_callback */
+static void
+neighbor_link_callback(rpl_parent_t *parent, int status, int numtx)
+{
+  if(status == MAC_TX_NOACK) {
+    return;
+  }
+  if(update_hbh_edc(status)) {
     /* Calculate EDC and update rank */
     if(parent && parent->dag) {
       parent->dag->rank = calculate_rank(parent, 0);
@@ -266,13 +346,26 @@ neighbor_link_callback(rpl_parent_t *parent, int known, int edc)
   }
 }
 
+/* Called after a transmission that was not acked by any neighbor */
+void
+orpl_noack_callback()
+{
+  if(update_hbh_edc(MAC_TX_NOACK)) {
+    rpl_dag_t *dag = rpl_get_any_dag();
+    /* Calculate EDC and update rank */
+    if(dag) {
+      dag->rank = calculate_rank(NULL, 0);
+    }
+  }
+}
+
 static rpl_rank_t
 calculate_rank(rpl_parent_t *parent, rpl_rank_t base_rank)
 {
   /* EDC is an estimate of the number of cycles to reach the root with
    * multi-path routing, using all potential forwarders. We therefore
    * update the ORPL EDC every time we calculate it. */
-  rpl_rank_t edc = orpl_calculate_edc(0);
+  rpl_rank_t edc = orpl_filter_edc(orpl_calculate_edc(0));
   orpl_update_edc(edc);
   return edc;
 }
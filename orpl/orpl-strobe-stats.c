@@ -0,0 +1,126 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Strobe-level transmission statistics, filled in by ContikiMAC
+ *         and dumped periodically by orpl-log.
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#include "orpl-strobe-stats.h"
+#include <string.h>
+
+#if WITH_ORPL && ORPL_WITH_STROBE_STATS
+
+static struct orpl_strobe_stats class_stats[ORPL_STROBE_STATS_CLASSES];
+static const char *class_names[ORPL_STROBE_STATS_CLASSES] = {
+  "bc", "up", "down", "nbr", "recover"
+};
+NBR_TABLE_GLOBAL(struct orpl_strobe_stats, orpl_strobe_stats_nbr);
+
+/* Accumulate a transmission into a statistics entry */
+static void
+stats_add(struct orpl_strobe_stats *s, rtimer_clock_t strobe_time, uint16_t strobes,
+    uint8_t acked, rtimer_clock_t ack_latency, uint8_t collisions)
+{
+  s->strobe_time += strobe_time;
+  s->tx_count++;
+  s->strobe_count += strobes;
+  s->collision_count += collisions;
+  if(acked) {
+    s->ack_count++;
+    s->ack_latency += ack_latency;
+  }
+}
+
+/* Record a transmission. direction is direction_none for broadcast. acker
+ * is the neighbor that acked the transmission, NULL if none. ack_latency
+ * is only meaningful if acked. */
+void
+orpl_strobe_stats_record(enum anycast_direction_e direction, const rimeaddr_t *acker,
+    rtimer_clock_t strobe_time, uint16_t strobes, uint8_t acked,
+    rtimer_clock_t ack_latency, uint8_t collisions)
+{
+  if(direction >= ORPL_STROBE_STATS_CLASSES) {
+    return;
+  }
+  stats_add(&class_stats[direction], strobe_time, strobes, acked, ack_latency, collisions);
+
+  if(acker != NULL) {
+    struct orpl_strobe_stats *s = nbr_table_get_from_lladdr(orpl_strobe_stats_nbr, acker);
+    if(s == NULL) {
+      s = nbr_table_add_lladdr(orpl_strobe_stats_nbr, acker);
+      if(s != NULL) {
+        memset(s, 0, sizeof(*s));
+      }
+    }
+    if(s != NULL) {
+      stats_add(s, strobe_time, strobes, acked, ack_latency, collisions);
+    }
+  }
+}
+
+/* Returns the statistics of a given traffic class */
+const struct orpl_strobe_stats *
+orpl_strobe_stats_class(enum anycast_direction_e direction)
+{
+  return direction < ORPL_STROBE_STATS_CLASSES ? &class_stats[direction] : NULL;
+}
+
+/* Returns a short name for a traffic class */
+const char *
+orpl_strobe_stats_class_name(enum anycast_direction_e direction)
+{
+  return direction < ORPL_STROBE_STATS_CLASSES ? class_names[direction] : "?";
+}
+
+/* Clear all statistics */
+void
+orpl_strobe_stats_reset()
+{
+  struct orpl_strobe_stats *s;
+  memset(class_stats, 0, sizeof(class_stats));
+  for(s = nbr_table_head(orpl_strobe_stats_nbr); s != NULL;
+      s = nbr_table_next(orpl_strobe_stats_nbr, s)) {
+    memset(s, 0, sizeof(*s));
+  }
+}
+
+/* Initialize strobe statistics */
+void
+orpl_strobe_stats_init()
+{
+  nbr_table_register(orpl_strobe_stats_nbr, NULL);
+}
+
+#endif /* WITH_ORPL && ORPL_WITH_STROBE_STATS */
@@ -0,0 +1,77 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Strobe-level transmission statistics, per anycast direction and
+ *         per neighbor, used to attribute radio-on time to traffic classes.
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#ifndef __ORPL_STROBE_STATS_H__
+#define __ORPL_STROBE_STATS_H__
+
+#include "orpl.h"
+#include "orpl-anycast.h"
+#include "sys/rtimer.h"
+
+/* Number of traffic classes: broadcast (direction_none), up, down, nbr, recover */
+#define ORPL_STROBE_STATS_CLASSES (direction_recover + 1)
+
+struct orpl_strobe_stats {
+  uint32_t strobe_time; /* Total strobe time, in rtimer ticks */
+  uint32_t ack_latency; /* Sum of the time to the first ACK, in rtimer ticks */
+  uint16_t tx_count; /* Number of transmissions */
+  uint16_t strobe_count; /* Number of strobes */
+  uint16_t ack_count; /* Number of acked transmissions */
+  uint16_t collision_count; /* Number of collisions */
+};
+
+/* Per-neighbor statistics, for the transmissions acked by the neighbor */
+NBR_TABLE_DECLARE(orpl_strobe_stats_nbr);
+
+/* Record a transmission. direction is direction_none for broadcast. acker
+ * is the neighbor that acked the transmission, NULL if none. ack_latency
+ * is only meaningful if acked. */
+void orpl_strobe_stats_record(enum anycast_direction_e direction, const rimeaddr_t *acker,
+    rtimer_clock_t strobe_time, uint16_t strobes, uint8_t acked,
+    rtimer_clock_t ack_latency, uint8_t collisions);
+/* Returns the statistics of a given traffic class */
+const struct orpl_strobe_stats *orpl_strobe_stats_class(enum anycast_direction_e direction);
+/* Returns a short name for a traffic class */
+const char *orpl_strobe_stats_class_name(enum anycast_direction_e direction);
+/* Clear all statistics */
+void orpl_strobe_stats_reset();
+/* Initialize strobe statistics */
+void orpl_strobe_stats_init();
+
+#endif /* __ORPL_STROBE_STATS_H__ */
@@ -40,6 +40,7 @@
 #include "orpl.h"
 #include "orpl-anycast.h"
 #include "orpl-routing-set.h"
+#include "orpl-strobe-stats.h"
 #include "net/packetbuf.h"
 #include "net/simple-udp.h"
 #include "net/uip-ds6.h"
@@ -53,6 +54,8 @@
 #define DEBUG DEBUG_NONE
 #include "net/uip-debug.h"
 
+#define UIP_IP_BUF ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
+
 /* The global IPv6 address in use */
 uip_ipaddr_t global_ipv6;
 
@@ -64,17 +67,70 @@ int sending_routing_set = 0;
 /* Total number of broadcast sent */
 uint32_t orpl_broadcast_count = 0;
 
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+/* Number of distinct neighbors that acked the ongoing broadcast */
+static uint8_t broadcast_ackers = 0;
+/* Set if the ongoing broadcast strobe ended before its full duration */
+static uint8_t broadcast_stopped_early = 0;
+#endif
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+/* Reachable neighbors at the start of the ongoing broadcast, and how many
+ * of them did not ack it yet */
+static uint8_t broadcast_reachable = 0;
+static uint8_t broadcast_waiting = 0;
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+/* One broadcast out of ORPL_BROADCAST_FULL_STROBE_PERIOD uses a full strobe */
+#define ORPL_BROADCAST_FULL_STROBE_PERIOD 8
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+
 /* Defines whether all neighbors we have a good link to should be included
  * in our routing set, regardless of them being children or not. */
 #define ORPL_ALL_NEIGHBORS_IN_ROUTING_SET 1
 
+/* Continuous operation mode, an alternative to FREEZE_TOPOLOGY for long-lived
+ * deployments. When set:
+ * - EDC changes are applied only when they exceed a threshold for a sustained period
+ * - routing sets are aged (swapped) on a slow epoch rather than at every trickle timer */
+#ifdef ORPL_CONF_WITH_RANK_HYSTERESIS
+#define ORPL_WITH_RANK_HYSTERESIS ORPL_CONF_WITH_RANK_HYSTERESIS
+#else /* ORPL_CONF_WITH_RANK_HYSTERESIS */
+#define ORPL_WITH_RANK_HYSTERESIS 0
+#endif /* ORPL_CONF_WITH_RANK_HYSTERESIS */
+
 /* When set:
  * - stop updating EDC after N seconds
  * - start updating Routing sets only after N+1 seconds
  * - don't age routing sets */
 #ifndef FREEZE_TOPOLOGY
-#define FREEZE_TOPOLOGY 1
+#define FREEZE_TOPOLOGY (!ORPL_WITH_RANK_HYSTERESIS)
+#endif
+
+#if FREEZE_TOPOLOGY && ORPL_WITH_RANK_HYSTERESIS
+#error "FREEZE_TOPOLOGY and ORPL_CONF_WITH_RANK_HYSTERESIS are mutually exclusive"
+#endif
+
+#if ORPL_WITH_RANK_HYSTERESIS
+/* Minimum EDC change before we consider updating our EDC */
+#ifdef ORPL_CONF_RANK_HYSTERESIS_THRESHOLD
+#define RANK_HYSTERESIS_THRESHOLD ORPL_CONF_RANK_HYSTERESIS_THRESHOLD
+#else
+#define RANK_HYSTERESIS_THRESHOLD (EDC_DIVISOR/2)
+#endif
+/* Time the change must be sustained before we update our EDC */
+#ifdef ORPL_CONF_RANK_HYSTERESIS_TIME
+#define RANK_HYSTERESIS_TIME ORPL_CONF_RANK_HYSTERESIS_TIME
+#else
+#define RANK_HYSTERESIS_TIME (60 * CLOCK_SECOND)
 #endif
+/* Routing set ageing epoch, in seconds */
+#ifdef ORPL_CONF_ROUTING_SET_SWAP_EPOCH
+#define ROUTING_SET_SWAP_EPOCH ORPL_CONF_ROUTING_SET_SWAP_EPOCH
+#else
+#define ROUTING_SET_SWAP_EPOCH (15*60)
+#endif
+#endif /* ORPL_WITH_RANK_HYSTERESIS */
 
 #if FREEZE_TOPOLOGY
 #define UPDATE_EDC_MAX_TIME 4*60
@@ -136,10 +192,73 @@ static rpl_instance_t *curr_instance;
 #define BLACKLIST_SIZE 16
 static uint32_t blacklisted_seqnos[BLACKLIST_SIZE];
 
+/* App-layer duplicate detection, done for every anycast received by
+ * contikimac and for every datagram unpacked from an aggregate */
+#define APP_SEQNO_HISTORY 32
+static uint32_t received_app_seqnos[APP_SEQNO_HISTORY];
+
+#if ORPL_WITH_FP_CACHE
+/* Destinations that are in our routing set but possibly not in our subtree */
+struct fp_cache_entry {
+  uint8_t uuid[8]; /* UUID64 of the destination */
+  uint32_t last_seqno; /* Last packet counted, a packet counts once */
+  uint8_t failures;
+  struct timer lifetime; /* Restarted at every failure */
+};
+/* The false positive cache, most recent first */
+static struct fp_cache_entry fp_cache[ORPL_FP_CACHE_SIZE];
+static int fp_cache_count = 0;
+/* Offset of the destination UUID64 in the 6LoWPAN payload of a data
+ * packet, see also orpl_anycast_802154_frame_must_ack */
+#define PAYLOAD_DEST_UUID_OFFSET 13
+#endif /* ORPL_WITH_FP_CACHE */
+
 static void broadcast_routing_set(void *ptr);
 
 /* Seqno of the next packet to be sent */
 static uint32_t current_seqno = 0;
+/* Next seqno generated by orpl_get_new_seqno */
+static uint32_t next_new_seqno = 0;
+
+#if ORPL_WITH_PRIORITY_QUEUEING
+/* Priority and lifetime of the next packet to be sent, set by the app */
+static uint8_t current_priority = 0;
+static clock_time_t current_lifetime = 0;
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+#if ORPL_WITH_RANK_HYSTERESIS
+/* The EDC we currently advertise */
+static rpl_rank_t stable_edc = 0xffff;
+/* Set when the calculated EDC is beyond the threshold, since edc_change_start */
+static int edc_change_pending = 0;
+static clock_time_t edc_change_start;
+/* Set if the pending change is an EDC increase */
+static uint8_t edc_change_up;
+/* Time of the last routing set swap, in seconds of uptime */
+static clock_time_t last_routing_set_swap = 0;
+#endif /* ORPL_WITH_RANK_HYSTERESIS */
+
+/* The current forwarding cost weight, see ORPL_EDC_W */
+static uint16_t edc_w = ORPL_EDC_W;
+
+#if ORPL_WITH_ADAPTIVE_EDC_W
+/* Period of the EDC_W controller */
+#define EDC_W_UPDATE_PERIOD (60 * CLOCK_SECOND)
+/* Step by which EDC_W is increased or decreased */
+#define EDC_W_STEP (EDC_DIVISOR / 8)
+/* Minimum number of anycast received before considering the duplicate rate */
+#define EDC_W_MIN_RX_COUNT 8
+/* Duplicate rates (in percent) above which W is increased, and below which it may be decreased */
+#define EDC_W_DUP_HIGH 5
+#define EDC_W_DUP_LOW 1
+/* Average upwards strobe duration above which W is decreased, to enlarge forwarder sets */
+#define EDC_W_STROBE_THRESHOLD (EDC_DIVISOR / 4)
+/* Anycast and duplicate counts, for the current controller period */
+static uint16_t anycast_rx_count;
+static uint16_t anycast_dup_count;
+/* Timer for the EDC_W controller */
+static struct ctimer edc_w_timer;
+#endif /* ORPL_WITH_ADAPTIVE_EDC_W */
 
 static init_done = 0;
 static clock_time_t init_time;
@@ -194,14 +313,15 @@ orpl_get_curr_seqno()
   return ret;
 }
 
-/* Get a new ORPL sequence number */
+/* Get a new ORPL sequence number. Does not change the current one, as
+ * seqnos are also drawn for aggregates, outside of any tcpip output. */
 uint32_t
 orpl_get_new_seqno()
 {
-  while(current_seqno == 0) {
-    current_seqno = random_rand();
+  while(next_new_seqno == 0) {
+    next_new_seqno = random_rand();
   }
-  return current_seqno++;
+  return next_new_seqno++;
 }
 
 /* Set the current ORPL sequence number before sending */
@@ -210,6 +330,71 @@ void orpl_set_curr_seqno(uint32_t seqno)
   current_seqno = seqno;
 }
 
+#if ORPL_WITH_PRIORITY_QUEUEING
+/* Set the priority and lifetime of the next packet we originate */
+void
+orpl_set_curr_priority(uint8_t priority, clock_time_t lifetime)
+{
+  current_priority = priority > ORPL_PRIORITY_MAX ? ORPL_PRIORITY_MAX : priority;
+  current_lifetime = lifetime;
+}
+
+/* Set in packetbuf the priority and deadline of the packet being sent:
+ * those set by the app if we originate it. A forwarded packet keeps those
+ * it was received with, contikimac carries them hop by hop, the deadline
+ * as a remaining lifetime. Returns 0 if the deadline has passed. */
+int
+orpl_packetbuf_set_priority(int is_originator)
+{
+  uint16_t deadline;
+  if(is_originator) {
+    deadline = 0;
+    if(current_lifetime != 0) {
+      deadline = clock_time() + current_lifetime;
+      if(deadline == 0) {
+        /* 0 stands for no deadline */
+        deadline = 1;
+      }
+    }
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_PRIORITY, current_priority);
+    packetbuf_set_attr(PACKETBUF_ATTR_ORPL_DEADLINE, deadline);
+    /* The app must set the priority before next transmission */
+    current_priority = 0;
+    current_lifetime = 0;
+    return 1;
+  }
+  return !orpl_packetbuf_is_expired();
+}
+
+/* Returns 1 if the packet in packetbuf has a deadline that has passed */
+int
+orpl_packetbuf_is_expired()
+{
+  uint16_t deadline = packetbuf_attr(PACKETBUF_ATTR_ORPL_DEADLINE);
+  return deadline != 0 && !CLOCK_LT((uint16_t)clock_time(), deadline);
+}
+#endif /* ORPL_WITH_PRIORITY_QUEUEING */
+
+#if ORPL_WITH_TX_BUDGET
+/* Set in packetbuf the transmission budget of the packet being sent: a
+ * full budget if we originate it, otherwise what the transmission that
+ * brought it to us left of the budget in packetbuf. Packets received
+ * without a budget, e.g. from outside the PAN, get a full one.
+ * Returns 0 if the budget is spent, i.e. the packet must be dropped. */
+int
+orpl_packetbuf_set_budget(int is_originator)
+{
+  uint8_t budget = packetbuf_attr(PACKETBUF_ATTR_ORPL_BUDGET);
+  if(is_originator || budget == 0) {
+    budget = ORPL_TX_BUDGET;
+  } else if(--budget == 0) {
+    return 0;
+  }
+  packetbuf_set_attr(PACKETBUF_ATTR_ORPL_BUDGET, budget);
+  return 1;
+}
+#endif /* ORPL_WITH_TX_BUDGET */
+
 /* Build a global IPv6 address from a link-local IPv6 address */
 static void
 global_ipaddr_from_llipaddr(uip_ipaddr_t *gipaddr, const uip_ipaddr_t *llipaddr)
@@ -237,6 +422,43 @@ orpl_is_edc_frozen()
   return FREEZE_TOPOLOGY && orpl_up_only == 0 && orpl_uptime() > UPDATE_EDC_MAX_TIME;
 }
 
+/* Returns the EDC to be used, from a newly calculated one. In continuous operation
+ * mode, this filters out EDC changes that are small or not sustained over time. */
+rpl_rank_t
+orpl_filter_edc(rpl_rank_t edc)
+{
+#if ORPL_WITH_RANK_HYSTERESIS
+  rpl_rank_t diff;
+
+  if(stable_edc == 0xffff || edc == 0xffff) {
+    /* Initial EDC, or we have no forwarder anymore: apply right away */
+    stable_edc = edc;
+    edc_change_pending = 0;
+    return stable_edc;
+  }
+
+  diff = edc > stable_edc ? edc - stable_edc : stable_edc - edc;
+  if(diff <= RANK_HYSTERESIS_THRESHOLD) {
+    /* Small change, stick to the stable EDC */
+    edc_change_pending = 0;
+  } else if(!edc_change_pending || edc_change_up != (edc > stable_edc)) {
+    /* Start of a significant change, or the pending one reversed: samples
+     * in one direction must not commit a change in the other */
+    edc_change_pending = 1;
+    edc_change_up = edc > stable_edc;
+    edc_change_start = clock_time();
+  } else if(clock_time() - edc_change_start >= RANK_HYSTERESIS_TIME) {
+    /* The change is sustained, apply it */
+    PRINTF("ORPL: hysteresis, edc %u -> %u\n", stable_edc, edc);
+    stable_edc = edc;
+    edc_change_pending = 0;
+  }
+  return stable_edc;
+#else /* ORPL_WITH_RANK_HYSTERESIS */
+  return edc;
+#endif /* ORPL_WITH_RANK_HYSTERESIS */
+}
+
 /* Returns 1 routing sets are active, i.e. we can start inserting and merging */
 int
 orpl_are_routing_set_active()
@@ -267,13 +489,34 @@ orpl_is_reachable_neighbor_from_lladdr(const uip_lladdr_t *lladdr)
    * at least 4 broadcasts to estimate link quality */
   if(lladdr != NULL && orpl_broadcast_count >= 4) {
     rpl_parent_t *p = rpl_get_parent(lladdr);
-    uint16_t bc_count = p == NULL ? 0 : p->bc_ackcount;
+    uint16_t bc_count = p == NULL ? 0 : orpl_broadcast_ackcount(p);
     return 100*bc_count/orpl_broadcast_count >= NEIGHBOR_PRR_THRESHOLD;
   } else {
     return 0;
   }
 }
 
+/* Returns the broadcast ack count of a neighbor, out of orpl_broadcast_count.
+ * When strobes may end early, acks are counted over the broadcasts the
+ * neighbor had a full chance to ack only, and scaled. */
+uint16_t
+orpl_broadcast_ackcount(const rpl_parent_t *p)
+{
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+  uint32_t ackcount;
+  if(p->bc_count == 0) {
+    return 0;
+  }
+  ackcount = (uint32_t)p->bc_ackcount * orpl_broadcast_count / p->bc_count;
+  if(ackcount > orpl_broadcast_count) {
+    ackcount = orpl_broadcast_count;
+  }
+  return ackcount > 0xffff ? 0xffff : ackcount;
+#else /* ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS */
+  return p->bc_ackcount;
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS */
+}
+
 /* Returns 1 if addr is the global ip of a reachable neighbor */
 int
 orpl_is_reachable_neighbor(const uip_ipaddr_t *ipaddr)
@@ -293,7 +536,7 @@ orpl_is_reachable_child(const uip_ipaddr_t *ipaddr)
     if(orpl_is_reachable_neighbor_from_lladdr(&lladdr)) {
       rpl_rank_t curr_edc = orpl_current_edc();
       rpl_rank_t neighbor_edc = rpl_get_parent_rank(&lladdr);
-      return neighbor_edc > ORPL_EDC_W && (neighbor_edc - ORPL_EDC_W) > curr_edc;
+      return neighbor_edc > edc_w && (neighbor_edc - edc_w) > curr_edc;
     }
   }
   return 0;
@@ -325,6 +568,31 @@ orpl_blacklist_contains(uint32_t seqno)
   return 0;
 }
 
+/* Returns 1 if a packet with this sequence number was already received */
+int
+orpl_app_seqno_contains(uint32_t seqno)
+{
+  int i;
+  for(i = 0; i < APP_SEQNO_HISTORY; ++i) {
+    if(seqno == received_app_seqnos[i]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Insert the sequence number of a received packet to the history used
+ * for app-layer duplicate detection */
+void
+orpl_app_seqno_insert(uint32_t seqno)
+{
+  int i;
+  for(i = APP_SEQNO_HISTORY - 1; i > 0; --i) {
+    received_app_seqnos[i] = received_app_seqnos[i - 1];
+  }
+  received_app_seqnos[0] = seqno;
+}
+
 /* A packet was routed downwards successfully, insert it into our
  * history. Used during false positive recovery. */
 void
@@ -353,6 +621,140 @@ orpl_acked_down_contains(uint32_t seqno, const rimeaddr_t *child)
   return 0;
 }
 
+#if ORPL_WITH_FP_CACHE
+/* Get the IPv6 destination of the data packet in packetbuf, which may
+ * reference the packet's queuebuf (CONTIKIMAC_CONF_WITH_ZERO_COPY) */
+void
+orpl_packetbuf_dest_ipaddr(uip_ipaddr_t *ipaddr)
+{
+  uint8_t *ptr = packetbuf_is_reference() ? packetbuf_reference_ptr() : packetbuf_dataptr();
+  memcpy(ipaddr, &global_ipv6, 8);
+  memcpy(ipaddr->u8 + 8, ptr + PAYLOAD_DEST_UUID_OFFSET, 8);
+}
+
+/* Returns the false positive cache entry of a destination, NULL if none */
+static struct fp_cache_entry *
+fp_cache_lookup(const uip_ipaddr_t *ipaddr)
+{
+  int i;
+  for(i = 0; i < fp_cache_count; ++i) {
+    if(!memcmp(fp_cache[i].uuid, ipaddr->u8 + 8, 8)) {
+      return &fp_cache[i];
+    }
+  }
+  return NULL;
+}
+
+/* Count a failure to route packet seqno down to a destination. A single
+ * failure may be plain link loss: the destination is only cached once
+ * ORPL_FP_CACHE_THRESHOLD distinct packets failed within the lifetime. */
+void
+orpl_fp_cache_report(const uip_ipaddr_t *ipaddr, uint32_t seqno)
+{
+  struct fp_cache_entry *e;
+  int i;
+
+  if(orpl_is_root()) {
+    /* The root has no parent to climb to, keep trying down */
+    return;
+  }
+
+  e = fp_cache_lookup(ipaddr);
+  if(e != NULL && timer_expired(&e->lifetime)) {
+    e->failures = 0;
+  }
+  if(e == NULL) {
+    /* Replace the least recently failed entry */
+    for(i = ORPL_FP_CACHE_SIZE - 1; i > 0; --i) {
+      fp_cache[i] = fp_cache[i - 1];
+    }
+    if(fp_cache_count < ORPL_FP_CACHE_SIZE) {
+      fp_cache_count++;
+    }
+    e = &fp_cache[0];
+    memcpy(e->uuid, ipaddr->u8 + 8, 8);
+    e->failures = 0;
+  } else if(e->failures > 0 && seqno == e->last_seqno) {
+    /* Already counted, e.g. exploration giving up after a failed anycast */
+    return;
+  }
+
+  e->last_seqno = seqno;
+  if(e->failures < ORPL_FP_CACHE_THRESHOLD) {
+    e->failures++;
+  }
+  timer_set(&e->lifetime, ORPL_FP_CACHE_LIFETIME);
+  ORPL_LOG("ORPL: false positive %u/%u for %u\n", e->failures, ORPL_FP_CACHE_THRESHOLD,
+      ORPL_LOG_NODEID_FROM_IPADDR(ipaddr));
+}
+
+/* Returns 1 if a destination is in the false positive cache */
+int
+orpl_fp_cache_contains(const uip_ipaddr_t *ipaddr)
+{
+  struct fp_cache_entry *e = fp_cache_lookup(ipaddr);
+  return e != NULL && e->failures >= ORPL_FP_CACHE_THRESHOLD
+      && !timer_expired(&e->lifetime);
+}
+
+/* Flush the false positive cache, after the routing set changed */
+static void
+fp_cache_flush()
+{
+  fp_cache_count = 0;
+}
+#endif /* ORPL_WITH_FP_CACHE */
+
+#if ORPL_WITH_FP_EXPLORATION
+/* Returns the number of distinct children that acked a packet down */
+static int
+acked_down_children(uint32_t seqno)
+{
+  int i, j;
+  int children = 0;
+  for(i = 0; i < ACKED_DOWN_SIZE; ++i) {
+    if(seqno != acked_down[i].seqno) {
+      continue;
+    }
+    for(j = 0; j < i; ++j) {
+      if(seqno == acked_down[j].seqno
+          && rimeaddr_cmp(&acked_down[i].child, &acked_down[j].child)) {
+        break;
+      }
+    }
+    if(j == i) {
+      children++;
+    }
+  }
+  return children;
+}
+
+/* Returns 1 if we are done exploring our subtree for a packet: every child
+ * that acked it down and came back with a false positive is blacklisted for
+ * it, and we tried ORPL_FP_EXPLORATION_MAX_CHILDREN of them. The root
+ * never gives up, as it has no parent to climb to. */
+int
+orpl_fp_exploration_done(uint32_t seqno)
+{
+  return !orpl_is_root() && !orpl_blacklist_contains(seqno)
+      && acked_down_children(seqno) >= ORPL_FP_EXPLORATION_MAX_CHILDREN;
+}
+
+/* Give up on our subtree for a packet: blacklist it so that it climbs.
+ * Called from tcpip, with the packet in uip_buf. */
+void
+orpl_fp_exploration_end(uint32_t seqno)
+{
+  ORPL_LOG("ORPL: exploration of %lx done after %d children\n", seqno,
+      acked_down_children(seqno));
+  orpl_blacklist_insert(seqno);
+#if ORPL_WITH_FP_CACHE
+  orpl_fp_cache_report(&UIP_IP_BUF->destipaddr, seqno);
+#endif /* ORPL_WITH_FP_CACHE */
+  ORPL_LOG_INC_FPCOUNT_FROM_UIP();
+}
+#endif /* ORPL_WITH_FP_EXPLORATION */
+
 /* Schedule a routing set broadcast in a few seconds */
 static void
 request_routing_set_broadcast()
@@ -392,6 +794,19 @@ orpl_routing_set_sent(void *ptr, int status, int transmissions)
   if(status == MAC_TX_COLLISION) {
     request_routing_set_broadcast();
   }
+#if ORPL_WITH_BROADCAST_CLASSES
+  else if(status == MAC_TX_DEFERRED
+      && packetbuf_attr(PACKETBUF_ATTR_ORPL_COLLISION_REASON) == collision_rate_limit) {
+    /* Out of routing set budget. A broadcast already scheduled will carry
+     * the latest routing set, otherwise retry once a token is earned back. */
+    ORPL_LOG("ORPL: routing set broadcast rate limited\n");
+    if(ctimer_expired(&routing_set_broadcast_timer)) {
+      ctimer_set(&routing_set_broadcast_timer,
+          ORPL_BROADCAST_ROUTING_SET_INTERVAL + random_rand() % ORPL_BROADCAST_ROUTING_SET_INTERVAL,
+          broadcast_routing_set, NULL);
+    }
+  }
+#endif /* ORPL_WITH_BROADCAST_CLASSES */
 }
 
 /* UDP callback function for received routing sets */
@@ -457,10 +872,23 @@ orpl_trickle_callback(rpl_instance_t *instance)
   init_global_ipv6();
 
   if(orpl_are_routing_set_active()) {
-#if !FREEZE_TOPOLOGY
+#if ORPL_WITH_RANK_HYSTERESIS
+    /* Swap routing sets to implement ageing, on a slow epoch */
+    if(orpl_uptime() - last_routing_set_swap >= ROUTING_SET_SWAP_EPOCH) {
+      ORPL_LOG("ORPL: swapping routing sets\n");
+      orpl_routing_set_swap();
+#if ORPL_WITH_FP_CACHE
+      fp_cache_flush();
+#endif /* ORPL_WITH_FP_CACHE */
+      last_routing_set_swap = orpl_uptime();
+    }
+#elif !FREEZE_TOPOLOGY
     /* Swap routing sets to implement ageing */
     ORPL_LOG("ORPL: swapping routing sets\n");
     orpl_routing_set_swap();
+#if ORPL_WITH_FP_CACHE
+    fp_cache_flush();
+#endif /* ORPL_WITH_FP_CACHE */
 #endif /* FREEZE_TOPOLOGY */
 
     /* Request transmission of routing set */
@@ -482,7 +910,65 @@ orpl_broadcast_acked(const rimeaddr_t *receiver)
     if(p->bc_ackcount > orpl_broadcast_count+1) {
       p->bc_ackcount = orpl_broadcast_count+1;
     }
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+    if(!p->bc_acked) {
+      broadcast_ackers++;
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+      if(p->bc_waited) {
+        broadcast_waiting--;
+      }
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+    }
+#endif
+    p->bc_acked = 1;
+  }
+}
+
+/* Called before a broadcast strobe. Selects the neighbors it waits for,
+ * so that orpl_broadcast_can_stop runs in constant time */
+void
+orpl_broadcast_start()
+{
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+  rpl_parent_t *p;
+  broadcast_reachable = 0;
+  /* Neighbors below NEIGHBOR_PRR_THRESHOLD, e.g. lossy or gone, are not
+   * waited for */
+  for(p = nbr_table_head(rpl_parents);
+      p != NULL;
+      p = nbr_table_next(rpl_parents, p)) {
+    p->bc_waited = orpl_is_reachable_neighbor_from_lladdr(
+        (uip_lladdr_t *)nbr_table_get_lladdr(rpl_parents, p));
+    if(p->bc_waited) {
+      broadcast_reachable++;
+    }
+  }
+  broadcast_waiting = broadcast_reachable;
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+}
+
+/* Returns 1 if the ongoing broadcast strobe can end, as enough neighbors acked */
+int
+orpl_broadcast_can_stop()
+{
+#if ORPL_BROADCAST_MAX_ACKERS
+  if(broadcast_ackers >= ORPL_BROADCAST_MAX_ACKERS) {
+    broadcast_stopped_early = 1;
+    return 1;
   }
+#endif /* ORPL_BROADCAST_MAX_ACKERS */
+
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+  /* Stop when all reachable neighbors acked this broadcast. Strobe fully
+   * as long as we know of no reachable neighbor. */
+  if(broadcast_reachable > 0 && broadcast_waiting == 0
+      && orpl_broadcast_count % ORPL_BROADCAST_FULL_STROBE_PERIOD != 0) {
+    broadcast_stopped_early = 1;
+    return 1;
+  }
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+
+  return 0;
 }
 
 /* Callback function at the end of a every broadcast
@@ -493,6 +979,30 @@ orpl_broadcast_done()
   /* Update global broacast count */
   orpl_broadcast_count++;
 
+  {
+    rpl_parent_t *p;
+    for(p = nbr_table_head(rpl_parents);
+        p != NULL;
+        p = nbr_table_next(rpl_parents, p)) {
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+      /* A strobe that ended early only gave a full chance to the
+       * neighbors it waited for. Others keep their ack ratio. */
+      if(!broadcast_stopped_early || p->bc_acked
+#if ORPL_WITH_BROADCAST_EARLY_STOP
+          || p->bc_waited
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP */
+          ) {
+        p->bc_count++;
+      }
+#endif /* ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS */
+      p->bc_acked = 0;
+    }
+  }
+#if ORPL_WITH_BROADCAST_EARLY_STOP || ORPL_BROADCAST_MAX_ACKERS
+  broadcast_ackers = 0;
+  broadcast_stopped_early = 0;
+#endif
+
   /* Loop over all neighbors and insert the reachable ones into
      out routing set */
   if(orpl_are_routing_set_active()) {
@@ -545,6 +1055,81 @@ orpl_update_edc(rpl_rank_t edc)
   curr_edc = edc;
 }
 
+/* Returns the current EDC_W, the forwarding cost weight */
+uint16_t
+orpl_edc_w()
+{
+  return edc_w;
+}
+
+/* Sets EDC_W, bounded to [ORPL_EDC_W_MIN, ORPL_EDC_W_MAX] */
+void
+orpl_set_edc_w(uint16_t w)
+{
+  if(w < ORPL_EDC_W_MIN) {
+    w = ORPL_EDC_W_MIN;
+  } else if(w > ORPL_EDC_W_MAX) {
+    w = ORPL_EDC_W_MAX;
+  }
+  if(w != edc_w) {
+    ORPL_LOG("ORPL: edc_w %u -> %u\n", edc_w, w);
+    edc_w = w;
+    /* W is part of our EDC */
+    rpl_recalculate_ranks();
+  }
+}
+
+/* Called for every anycast received, with is_duplicate set if the
+ * packet was dropped as duplicate. Used for adapting EDC_W. */
+void
+orpl_anycast_input(int is_duplicate)
+{
+#if ORPL_WITH_ADAPTIVE_EDC_W
+  if(anycast_rx_count < 0xffff) {
+    anycast_rx_count++;
+    if(is_duplicate) {
+      anycast_dup_count++;
+    }
+  }
+#endif /* ORPL_WITH_ADAPTIVE_EDC_W */
+}
+
+#if ORPL_WITH_ADAPTIVE_EDC_W
+/* Periodic EDC_W controller. A too small W results in loops and duplicates,
+ * a too large one in small forwarder sets and long strobes. We increase W
+ * when we see too many duplicates, and decrease it when duplicates are rare
+ * and our upwards strobes are long. */
+static void
+edc_w_update(void *ptr)
+{
+  extern int forwarder_set_size;
+  uint16_t dup_rate = 0;
+  uint16_t strobe_duration = orpl_hbh_edc(direction_up);
+
+  if(forwarder_set_size > 0) {
+    /* hbh_edc is weighted by the forwarder set size */
+    strobe_duration /= forwarder_set_size;
+  }
+  if(anycast_rx_count >= EDC_W_MIN_RX_COUNT) {
+    dup_rate = 100 * (uint32_t)anycast_dup_count / anycast_rx_count;
+  }
+
+  ORPL_LOG("ORPL: edc_w controller, w %u dup %u/%u strobe %u\n",
+      edc_w, anycast_dup_count, anycast_rx_count, strobe_duration);
+
+  if(dup_rate > EDC_W_DUP_HIGH) {
+    orpl_set_edc_w(edc_w + EDC_W_STEP);
+  } else if(dup_rate <= EDC_W_DUP_LOW && strobe_duration > EDC_W_STROBE_THRESHOLD
+      && edc_w > EDC_W_STEP) {
+    orpl_set_edc_w(edc_w - EDC_W_STEP);
+  }
+
+  anycast_rx_count = 0;
+  anycast_dup_count = 0;
+  ctimer_reset(&edc_w_timer);
+}
+#endif /* ORPL_WITH_ADAPTIVE_EDC_W */
+
 /* ORPL initialization */
 void
 orpl_init(int is_root, int up_only)
@@ -565,6 +1150,9 @@ orpl_init(int is_root, int up_only)
   /* Initialize routing set module */
   orpl_anycast_init();
   orpl_routing_set_init();
+#if ORPL_WITH_STROBE_STATS
+  orpl_strobe_stats_init();
+#endif /* ORPL_WITH_STROBE_STATS */
 
   /* Set up multicast UDP connectoin for dissemination of routing sets */
   uip_create_linklocal_allnodes_mcast(&routing_set_addr);
@@ -572,6 +1160,11 @@ orpl_init(int is_root, int up_only)
                         NULL, ROUTING_SET_PORT,
                         udp_received_routing_set);
 
+#if ORPL_WITH_ADAPTIVE_EDC_W
+  /* Start EDC_W controller */
+  ctimer_set(&edc_w_timer, EDC_W_UPDATE_PERIOD, edc_w_update, NULL);
+#endif /* ORPL_WITH_ADAPTIVE_EDC_W */
+
 }
 
 #endif /* WITH_ORPL */
@@ -48,12 +48,342 @@
 #define ORPL_EDC_W 64
 #endif /* ORPL_CONF_EDC_W */
 
+/* Adapt EDC_W at runtime, based on the observed duplicate rate and strobe
+ * durations. ORPL_EDC_W is then only the initial value. */
+#ifdef ORPL_CONF_WITH_ADAPTIVE_EDC_W
+#define ORPL_WITH_ADAPTIVE_EDC_W ORPL_CONF_WITH_ADAPTIVE_EDC_W
+#else /* ORPL_CONF_WITH_ADAPTIVE_EDC_W */
+#define ORPL_WITH_ADAPTIVE_EDC_W 0
+#endif /* ORPL_CONF_WITH_ADAPTIVE_EDC_W */
+
+/* Bounds for EDC_W, enforced by the controller and when setting W manually */
+#ifdef ORPL_CONF_EDC_W_MIN
+#define ORPL_EDC_W_MIN ORPL_CONF_EDC_W_MIN
+#else /* ORPL_CONF_EDC_W_MIN */
+#define ORPL_EDC_W_MIN (EDC_DIVISOR / 8)
+#endif /* ORPL_CONF_EDC_W_MIN */
+
+#ifdef ORPL_CONF_EDC_W_MAX
+#define ORPL_EDC_W_MAX ORPL_CONF_EDC_W_MAX
+#else /* ORPL_CONF_EDC_W_MAX */
+#define ORPL_EDC_W_MAX (2 * EDC_DIVISOR)
+#endif /* ORPL_CONF_EDC_W_MAX */
+
+/* Track the wake-up phase of the neighbors that ack us, and start upwards
+ * strobes shortly before the earliest expected wake-up of the forwarder set.
+ * Disables the random jitter of ContikiMAC wake-ups, which breaks phase-lock. */
+#ifdef ORPL_CONF_WITH_PHASE_TRACKER
+#define ORPL_WITH_PHASE_TRACKER ORPL_CONF_WITH_PHASE_TRACKER
+#else /* ORPL_CONF_WITH_PHASE_TRACKER */
+#define ORPL_WITH_PHASE_TRACKER 0
+#endif /* ORPL_CONF_WITH_PHASE_TRACKER */
+
+/* Send queued packets in bursts, to the forwarder that acked the first one.
+ * Must be set before including orpl-contiki-conf.h, which adjusts CCA counts. */
+#ifdef ORPL_CONF_WITH_BURST
+#define ORPL_WITH_BURST ORPL_CONF_WITH_BURST
+#else /* ORPL_CONF_WITH_BURST */
+#define ORPL_WITH_BURST 0
+#endif /* ORPL_CONF_WITH_BURST */
+
+/* On foreign traffic before transmitting, wait for it to end and check the
+ * channel again rather than reporting a collision right away. When a collision
+ * is only due to an incoming frame, csma retries right after it is received
+ * rather than after a full backoff. */
+#ifdef ORPL_CONF_WITH_COLLISION_RESCHEDULE
+#define ORPL_WITH_COLLISION_RESCHEDULE ORPL_CONF_WITH_COLLISION_RESCHEDULE
+#else /* ORPL_CONF_WITH_COLLISION_RESCHEDULE */
+#define ORPL_WITH_COLLISION_RESCHEDULE 0
+#endif /* ORPL_CONF_WITH_COLLISION_RESCHEDULE */
+
+/* Set to 1 to have csma queue anycast packets per direction (up, down,
+ * nbr, recover) rather than per IPv6 destination, so that packets from all
+ * origins share a queue and are sent in bursts. Queues are then served in
+ * round-robin order. */
+#ifdef ORPL_CONF_WITH_DIRECTION_QUEUES
+#define ORPL_WITH_DIRECTION_QUEUES ORPL_CONF_WITH_DIRECTION_QUEUES
+#else /* ORPL_CONF_WITH_DIRECTION_QUEUES */
+#define ORPL_WITH_DIRECTION_QUEUES 0
+#endif /* ORPL_CONF_WITH_DIRECTION_QUEUES */
+
+/* Set to 1 to let applications set a priority and a lifetime for the packets
+ * they originate, see orpl_set_curr_priority. csma queues packets by
+ * decreasing priority and drops them once their deadline has passed.
+ * Forwarders drop them too: the priority and the remaining lifetime are
+ * carried hop by hop in the contikimac header. */
+#ifdef ORPL_CONF_WITH_PRIORITY_QUEUEING
+#define ORPL_WITH_PRIORITY_QUEUEING ORPL_CONF_WITH_PRIORITY_QUEUEING
+#else /* ORPL_CONF_WITH_PRIORITY_QUEUEING */
+#define ORPL_WITH_PRIORITY_QUEUEING 0
+#endif /* ORPL_CONF_WITH_PRIORITY_QUEUEING */
+
+/* Highest packet priority */
+#define ORPL_PRIORITY_MAX 7
+
+/* Set to 1 to scale the csma backoff of anycasts to the expected strobe
+ * duration, derived from the hop-by-hop EDC of their direction, and to
+ * back off exponentially on repeated collisions. */
+#ifdef ORPL_CONF_WITH_ANYCAST_BACKOFF
+#define ORPL_WITH_ANYCAST_BACKOFF ORPL_CONF_WITH_ANYCAST_BACKOFF
+#else /* ORPL_CONF_WITH_ANYCAST_BACKOFF */
+#define ORPL_WITH_ANYCAST_BACKOFF 0
+#endif /* ORPL_CONF_WITH_ANYCAST_BACKOFF */
+
+/* Maximum exponent of the anycast collision backoff, per direction. The
+ * funnel towards the root sees the most contention. */
+#ifdef ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_UP
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_UP ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_UP
+#else /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_UP */
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_UP 4
+#endif /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_UP */
+
+#ifdef ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_DOWN
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_DOWN ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_DOWN
+#else /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_DOWN */
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_DOWN 2
+#endif /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_DOWN */
+
+#ifdef ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_NBR
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_NBR ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_NBR
+#else /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_NBR */
+#define ORPL_ANYCAST_BACKOFF_MAX_EXP_NBR 2
+#endif /* ORPL_CONF_ANYCAST_BACKOFF_MAX_EXP_NBR */
+
+/* Wait for ACKs based on the radio's SFD and FIFOP state rather than fixed
+ * delays: retransmit as soon as no ACK has started, and read the extended
+ * ACK as soon as it is received. */
+#ifdef ORPL_CONF_WITH_SFD_ACK_DETECTION
+#define ORPL_WITH_SFD_ACK_DETECTION ORPL_CONF_WITH_SFD_ACK_DETECTION
+#else /* ORPL_CONF_WITH_SFD_ACK_DETECTION */
+#define ORPL_WITH_SFD_ACK_DETECTION 0
+#endif /* ORPL_CONF_WITH_SFD_ACK_DETECTION */
+
+/* Adapt each node's channel check rate to the traffic it receives. The
+ * current rate is advertised in the extended ACK, and senders adapt their
+ * strobe time to the neighbors that may ack. */
+#ifdef ORPL_CONF_WITH_ADAPTIVE_CYCLE
+#define ORPL_WITH_ADAPTIVE_CYCLE ORPL_CONF_WITH_ADAPTIVE_CYCLE
+#else /* ORPL_CONF_WITH_ADAPTIVE_CYCLE */
+#define ORPL_WITH_ADAPTIVE_CYCLE 0
+#endif /* ORPL_CONF_WITH_ADAPTIVE_CYCLE */
+
+/* Receiver-initiated mode: nodes that are always on, or at the highest
+ * adaptive channel check level, broadcast short probes. Upwards anycast
+ * senders that recently heard a probe from a forwarder listen for the next
+ * one and transmit right after it instead of strobing. */
+#ifdef ORPL_CONF_WITH_RI_PROBES
+#define ORPL_WITH_RI_PROBES ORPL_CONF_WITH_RI_PROBES
+#else /* ORPL_CONF_WITH_RI_PROBES */
+#define ORPL_WITH_RI_PROBES 0
+#endif /* ORPL_CONF_WITH_RI_PROBES */
+
+/* Accumulate strobe time, strobes, collisions and ACK latency per
+ * direction and per neighbor (see orpl-strobe-stats.h) */
+#ifdef ORPL_CONF_WITH_STROBE_STATS
+#define ORPL_WITH_STROBE_STATS ORPL_CONF_WITH_STROBE_STATS
+#else /* ORPL_CONF_WITH_STROBE_STATS */
+#define ORPL_WITH_STROBE_STATS 0
+#endif /* ORPL_CONF_WITH_STROBE_STATS */
+
+/* Track occupancy, high-water marks and allocation failures of the
+ * CSMA memory pools, overall and per direction (see csma-stats.h) */
+#ifdef ORPL_CONF_WITH_CSMA_STATS
+#define ORPL_WITH_CSMA_STATS ORPL_CONF_WITH_CSMA_STATS
+#else /* ORPL_CONF_WITH_CSMA_STATS */
+#define ORPL_WITH_CSMA_STATS 0
+#endif /* ORPL_CONF_WITH_CSMA_STATS */
+
+/* End broadcast strobes as soon as every reachable neighbor (see
+ * NEIGHBOR_PRR_THRESHOLD) has acked the current one. Every ORPL_BROADCAST_FULL_STROBE_PERIOD
+ * broadcasts, the full strobe is still used, to discover new neighbors. */
+#ifdef ORPL_CONF_WITH_BROADCAST_EARLY_STOP
+#define ORPL_WITH_BROADCAST_EARLY_STOP ORPL_CONF_WITH_BROADCAST_EARLY_STOP
+#else /* ORPL_CONF_WITH_BROADCAST_EARLY_STOP */
+#define ORPL_WITH_BROADCAST_EARLY_STOP 0
+#endif /* ORPL_CONF_WITH_BROADCAST_EARLY_STOP */
+
+/* End broadcast strobes after that many distinct neighbors acked, 0 for
+ * no limit. As with ORPL_WITH_BROADCAST_EARLY_STOP, a strobe that ended
+ * early is not counted in the ack ratio of neighbors that did not ack it. */
+#ifdef ORPL_CONF_BROADCAST_MAX_ACKERS
+#define ORPL_BROADCAST_MAX_ACKERS ORPL_CONF_BROADCAST_MAX_ACKERS
+#else /* ORPL_CONF_BROADCAST_MAX_ACKERS */
+#define ORPL_BROADCAST_MAX_ACKERS 0
+#endif /* ORPL_CONF_BROADCAST_MAX_ACKERS */
+
+/* Set to 1 to rate-limit broadcasts with one token bucket per traffic
+ * class (routing sets, RPL control, application) rather than with the single
+ * CONTIKIMAC_CONF_BROADCAST_RATE_LIMIT budget. Rate-limited broadcasts are
+ * not retried by csma and are reported up as MAC_TX_DEFERRED, which link
+ * estimators do not count as a failure. */
+#ifdef ORPL_CONF_WITH_BROADCAST_CLASSES
+#define ORPL_WITH_BROADCAST_CLASSES ORPL_CONF_WITH_BROADCAST_CLASSES
+#else /* ORPL_CONF_WITH_BROADCAST_CLASSES */
+#define ORPL_WITH_BROADCAST_CLASSES 0
+#endif /* ORPL_CONF_WITH_BROADCAST_CLASSES */
+
+/* Token bucket of each broadcast class: maximum burst, and time to earn
+ * back one token. A class whose bucket is empty may take a token from a
+ * class of strictly lower priority, as long as that class keeps one. */
+#ifdef ORPL_CONF_BROADCAST_ROUTING_SET_BUDGET
+#define ORPL_BROADCAST_ROUTING_SET_BUDGET ORPL_CONF_BROADCAST_ROUTING_SET_BUDGET
+#else /* ORPL_CONF_BROADCAST_ROUTING_SET_BUDGET */
+#define ORPL_BROADCAST_ROUTING_SET_BUDGET 2
+#endif /* ORPL_CONF_BROADCAST_ROUTING_SET_BUDGET */
+
+#ifdef ORPL_CONF_BROADCAST_ROUTING_SET_INTERVAL
+#define ORPL_BROADCAST_ROUTING_SET_INTERVAL ORPL_CONF_BROADCAST_ROUTING_SET_INTERVAL
+#else /* ORPL_CONF_BROADCAST_ROUTING_SET_INTERVAL */
+#define ORPL_BROADCAST_ROUTING_SET_INTERVAL (8 * CLOCK_SECOND)
+#endif /* ORPL_CONF_BROADCAST_ROUTING_SET_INTERVAL */
+
+#ifdef ORPL_CONF_BROADCAST_ROUTING_SET_PRIORITY
+#define ORPL_BROADCAST_ROUTING_SET_PRIORITY ORPL_CONF_BROADCAST_ROUTING_SET_PRIORITY
+#else /* ORPL_CONF_BROADCAST_ROUTING_SET_PRIORITY */
+#define ORPL_BROADCAST_ROUTING_SET_PRIORITY 2
+#endif /* ORPL_CONF_BROADCAST_ROUTING_SET_PRIORITY */
+
+#ifdef ORPL_CONF_BROADCAST_RPL_BUDGET
+#define ORPL_BROADCAST_RPL_BUDGET ORPL_CONF_BROADCAST_RPL_BUDGET
+#else /* ORPL_CONF_BROADCAST_RPL_BUDGET */
+#define ORPL_BROADCAST_RPL_BUDGET 4
+#endif /* ORPL_CONF_BROADCAST_RPL_BUDGET */
+
+#ifdef ORPL_CONF_BROADCAST_RPL_INTERVAL
+#define ORPL_BROADCAST_RPL_INTERVAL ORPL_CONF_BROADCAST_RPL_INTERVAL
+#else /* ORPL_CONF_BROADCAST_RPL_INTERVAL */
+#define ORPL_BROADCAST_RPL_INTERVAL (4 * CLOCK_SECOND)
+#endif /* ORPL_CONF_BROADCAST_RPL_INTERVAL */
+
+#ifdef ORPL_CONF_BROADCAST_RPL_PRIORITY
+#define ORPL_BROADCAST_RPL_PRIORITY ORPL_CONF_BROADCAST_RPL_PRIORITY
+#else /* ORPL_CONF_BROADCAST_RPL_PRIORITY */
+#define ORPL_BROADCAST_RPL_PRIORITY 1
+#endif /* ORPL_CONF_BROADCAST_RPL_PRIORITY */
+
+#ifdef ORPL_CONF_BROADCAST_APP_BUDGET
+#define ORPL_BROADCAST_APP_BUDGET ORPL_CONF_BROADCAST_APP_BUDGET
+#else /* ORPL_CONF_BROADCAST_APP_BUDGET */
+#define ORPL_BROADCAST_APP_BUDGET 2
+#endif /* ORPL_CONF_BROADCAST_APP_BUDGET */
+
+#ifdef ORPL_CONF_BROADCAST_APP_INTERVAL
+#define ORPL_BROADCAST_APP_INTERVAL ORPL_CONF_BROADCAST_APP_INTERVAL
+#else /* ORPL_CONF_BROADCAST_APP_INTERVAL */
+#define ORPL_BROADCAST_APP_INTERVAL (CLOCK_SECOND)
+#endif /* ORPL_CONF_BROADCAST_APP_INTERVAL */
+
+#ifdef ORPL_CONF_BROADCAST_APP_PRIORITY
+#define ORPL_BROADCAST_APP_PRIORITY ORPL_CONF_BROADCAST_APP_PRIORITY
+#else /* ORPL_CONF_BROADCAST_APP_PRIORITY */
+#define ORPL_BROADCAST_APP_PRIORITY 0
+#endif /* ORPL_CONF_BROADCAST_APP_PRIORITY */
+
 #ifdef ORPL_CONF_WITH_FP_RECOVERY
 #define ORPL_WITH_FP_RECOVERY ORPL_CONF_WITH_FP_RECOVERY
 #else /* ORPL_CONF_WITH_FP_RECOVERY */
 #define ORPL_WITH_FP_RECOVERY 1
 #endif /* ORPL_CONF_WITH_FP_RECOVERY */
 
+/* Set to 1 for a bounded depth-first false positive recovery. A node
+ * routes a packet down to at most ORPL_FP_EXPLORATION_MAX_CHILDREN of its
+ * children (recorded in the acked down history) before climbing, and a
+ * recovery that no parent takes back climbs further as a regular upward
+ * packet rather than being dropped. */
+#ifdef ORPL_CONF_WITH_FP_EXPLORATION
+#define ORPL_WITH_FP_EXPLORATION ORPL_CONF_WITH_FP_EXPLORATION
+#else /* ORPL_CONF_WITH_FP_EXPLORATION */
+#define ORPL_WITH_FP_EXPLORATION 0
+#endif /* ORPL_CONF_WITH_FP_EXPLORATION */
+
+#ifdef ORPL_CONF_FP_EXPLORATION_MAX_CHILDREN
+#define ORPL_FP_EXPLORATION_MAX_CHILDREN ORPL_CONF_FP_EXPLORATION_MAX_CHILDREN
+#else /* ORPL_CONF_FP_EXPLORATION_MAX_CHILDREN */
+#define ORPL_FP_EXPLORATION_MAX_CHILDREN 3
+#endif /* ORPL_CONF_FP_EXPLORATION_MAX_CHILDREN */
+
+/* Set to 1 to keep a cache of destinations that our routing set contains
+ * but that are not in our subtree. A failure is counted for a destination
+ * whenever routing one of its packets down fails here, and whenever a
+ * recovery for it comes back up to us, the recovery packet being the
+ * feedback from below. Once ORPL_FP_CACHE_THRESHOLD packets failed, the
+ * cache overrides the routing set, both when routing and when deciding to
+ * ack, for ORPL_FP_CACHE_LIFETIME or until the next routing set swap. The
+ * root, which has no parent to climb to, never caches. */
+#ifdef ORPL_CONF_WITH_FP_CACHE
+#define ORPL_WITH_FP_CACHE ORPL_CONF_WITH_FP_CACHE
+#else /* ORPL_CONF_WITH_FP_CACHE */
+#define ORPL_WITH_FP_CACHE 0
+#endif /* ORPL_CONF_WITH_FP_CACHE */
+
+#ifdef ORPL_CONF_FP_CACHE_SIZE
+#define ORPL_FP_CACHE_SIZE ORPL_CONF_FP_CACHE_SIZE
+#else /* ORPL_CONF_FP_CACHE_SIZE */
+#define ORPL_FP_CACHE_SIZE 8
+#endif /* ORPL_CONF_FP_CACHE_SIZE */
+
+/* Number of distinct packets that must fail before a destination is cached */
+#ifdef ORPL_CONF_FP_CACHE_THRESHOLD
+#define ORPL_FP_CACHE_THRESHOLD ORPL_CONF_FP_CACHE_THRESHOLD
+#else /* ORPL_CONF_FP_CACHE_THRESHOLD */
+#define ORPL_FP_CACHE_THRESHOLD 3
+#endif /* ORPL_CONF_FP_CACHE_THRESHOLD */
+
+/* Time after the last failure at which a cache entry expires */
+#ifdef ORPL_CONF_FP_CACHE_LIFETIME
+#define ORPL_FP_CACHE_LIFETIME ORPL_CONF_FP_CACHE_LIFETIME
+#else /* ORPL_CONF_FP_CACHE_LIFETIME */
+#define ORPL_FP_CACHE_LIFETIME (120 * CLOCK_SECOND)
+#endif /* ORPL_CONF_FP_CACHE_LIFETIME */
+
+/* Set to 1 to aggregate small upward datagrams: 6lowpan holds them for
+ * ORPL_AGGREGATION_DELAY and packs them into a single frame, that the
+ * forwarder unpacks before routing each datagram on its own. */
+#ifdef ORPL_CONF_WITH_AGGREGATION
+#define ORPL_WITH_AGGREGATION ORPL_CONF_WITH_AGGREGATION
+#else /* ORPL_CONF_WITH_AGGREGATION */
+#define ORPL_WITH_AGGREGATION 0
+#endif /* ORPL_CONF_WITH_AGGREGATION */
+
+/* Time a datagram waits for others to be aggregated with */
+#ifdef ORPL_CONF_AGGREGATION_DELAY
+#define ORPL_AGGREGATION_DELAY ORPL_CONF_AGGREGATION_DELAY
+#else /* ORPL_CONF_AGGREGATION_DELAY */
+#define ORPL_AGGREGATION_DELAY (CLOCK_SECOND / 64)
+#endif /* ORPL_CONF_AGGREGATION_DELAY */
+
+/* Size of the largest compressed datagram that gets aggregated */
+#ifdef ORPL_CONF_AGGREGATION_MAX_LEN
+#define ORPL_AGGREGATION_MAX_LEN ORPL_CONF_AGGREGATION_MAX_LEN
+#else /* ORPL_CONF_AGGREGATION_MAX_LEN */
+#define ORPL_AGGREGATION_MAX_LEN 48
+#endif /* ORPL_CONF_AGGREGATION_MAX_LEN */
+
+/* 6lowpan dispatch of an aggregate, from the range reserved by RFC 4944.
+ * An aggregate has no IPv6 header where the anycast layer looks for the
+ * destination of a data frame. */
+#define ORPL_AGGREGATE_DISPATCH 0x4f
+
+/* Set to 1 to bound the transmissions of a packet end-to-end, rather than
+ * only per hop, as recovery starts over with a fresh per-hop limit. The
+ * originator gives the packet ORPL_TX_BUDGET transmissions, and every
+ * frame carries what is left of it, that transmission included, in the
+ * contikimac header. csma neither retransmits nor recovers a packet whose
+ * budget is spent, and forwarders silently drop packets received with
+ * nothing left. Aggregated datagrams keep their own budget. */
+#ifdef ORPL_CONF_WITH_TX_BUDGET
+#define ORPL_WITH_TX_BUDGET ORPL_CONF_WITH_TX_BUDGET
+#else /* ORPL_CONF_WITH_TX_BUDGET */
+#define ORPL_WITH_TX_BUDGET 0
+#endif /* ORPL_CONF_WITH_TX_BUDGET */
+
+/* End-to-end transmission budget of the packets we originate, 1 to 255 */
+#ifdef ORPL_CONF_TX_BUDGET
+#define ORPL_TX_BUDGET ORPL_CONF_TX_BUDGET
+#else /* ORPL_CONF_TX_BUDGET */
+#define ORPL_TX_BUDGET 32
+#endif /* ORPL_CONF_TX_BUDGET */
+
 /* Default implementation for logging functions */
 #ifndef ORPL_LOG
 #define ORPL_LOG(...) PRINTF(__VA_ARGS__)
@@ -88,6 +418,9 @@
 #ifndef ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF
 #define ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF()
 #endif /* ORPL_LOG_INC_FPCOUNT_FROM_PACKETBUF */
+#ifndef ORPL_LOG_INC_FPCOUNT_FROM_UIP
+#define ORPL_LOG_INC_FPCOUNT_FROM_UIP()
+#endif /* ORPL_LOG_INC_FPCOUNT_FROM_UIP */
 #ifndef ORPL_LOG_PRINT_NEIGHBOR_LIST
 #define ORPL_LOG_PRINT_NEIGHBOR_LIST()
 #endif /* ORPL_LOG_PRINT_NEIGHBOR_LIST */
@@ -120,6 +453,17 @@ void orpl_set_curr_seqno(uint32_t seqno);
 uint32_t orpl_get_curr_seqno();
 /* Get a new ORPL sequence number */
 uint32_t orpl_get_new_seqno();
+/* Set the priority (0 to ORPL_PRIORITY_MAX) and lifetime (0 for none)
+ * of the next packet we originate */
+void orpl_set_curr_priority(uint8_t priority, clock_time_t lifetime);
+/* Set in packetbuf the priority and deadline of the packet being sent,
+ * originated or forwarded. Returns 0 if the deadline has passed. */
+int orpl_packetbuf_set_priority(int is_originator);
+/* Returns 1 if the packet in packetbuf has a deadline that has passed */
+int orpl_packetbuf_is_expired();
+/* Set the transmission budget of the packet being sent in packetbuf,
+ * returns 0 if the budget is spent */
+int orpl_packetbuf_set_budget(int is_originator);
 /* Returns 1 if EDC is frozen, i.e. we are not allowed to change edc */
 int orpl_is_edc_frozen();
 /* Returns 1 routing sets are active, i.e. we can start inserting and merging */
@@ -135,11 +479,27 @@ int orpl_is_reachable_neighbor(const uip_ipaddr_t *ipaddr);
 void orpl_blacklist_insert(uint32_t seqno);
 /* Returns 1 is the sequence number is contained in the blacklist */
 int orpl_blacklist_contains(uint32_t seqno);
+/* Returns 1 if a packet with this sequence number was already received */
+int orpl_app_seqno_contains(uint32_t seqno);
+/* Insert the sequence number of a received packet to the history used
+ * for app-layer duplicate detection */
+void orpl_app_seqno_insert(uint32_t seqno);
 /* A packet was routed downwards successfully, insert it into our
  * history. Used during false positive recovery. */
 void orpl_acked_down_insert(uint32_t seqno, const rimeaddr_t *child);
 /* Returns 1 if a given packet is in the acked down history */
 int orpl_acked_down_contains(uint32_t seqno, const rimeaddr_t *child);
+/* Returns 1 if ORPL_FP_EXPLORATION_MAX_CHILDREN distinct children failed
+ * to route a packet down. Has no side effect. */
+int orpl_fp_exploration_done(uint32_t seqno);
+/* Give up routing a packet down: blacklist it so that it climbs */
+void orpl_fp_exploration_end(uint32_t seqno);
+/* Get the IPv6 destination of the data packet in packetbuf */
+void orpl_packetbuf_dest_ipaddr(uip_ipaddr_t *ipaddr);
+/* Count a failure to route packet seqno down to a destination */
+void orpl_fp_cache_report(const uip_ipaddr_t *ipaddr, uint32_t seqno);
+/* Returns 1 if a destination is in the false positive cache */
+int orpl_fp_cache_contains(const uip_ipaddr_t *ipaddr);
 /* Callback function called after routing set transmissions */
 void orpl_routing_set_sent(void *ptr, int status, int transmissions);
 /* Function called when the trickle timer expires */
@@ -147,14 +507,37 @@ void orpl_trickle_callback(rpl_instance_t *instance);
 /* Callback function for every ACK received while broadcasting.
  * Used for beacon counting. */
 void orpl_broadcast_acked(const rimeaddr_t *receiver);
+/* Called before a broadcast strobe, selects the neighbors it waits for */
+void orpl_broadcast_start();
+/* Returns the broadcast ack count of a neighbor, out of orpl_broadcast_count */
+uint16_t orpl_broadcast_ackcount(const rpl_parent_t *p);
+/* Returns 1 if the ongoing broadcast strobe can end, as enough neighbors acked */
+int orpl_broadcast_can_stop();
 /* Callback function at the end of a every broadcast
  * Used for beacon counting. */
 void orpl_broadcast_done();
 /* Update the current EDC (rank of the node) */
 void orpl_update_edc(rpl_rank_t edc);
+/* Returns the EDC to be used, from a newly calculated one (hysteresis) */
+rpl_rank_t orpl_filter_edc(rpl_rank_t edc);
+/* Returns the current EDC_W, the forwarding cost weight */
+uint16_t orpl_edc_w();
+/* Sets EDC_W, bounded to [ORPL_EDC_W_MIN, ORPL_EDC_W_MAX] */
+void orpl_set_edc_w(uint16_t w);
+/* Called for every anycast received, with is_duplicate set if the
+ * packet was dropped as duplicate. Used for adapting EDC_W. */
+void orpl_anycast_input(int is_duplicate);
 /* ORPL initialization */
 void orpl_init(int is_root, int up_only);
 /* Function that computes the metric EDC */
 rpl_rank_t orpl_calculate_edc(int verbose);
+/* Returns the current hop-by-hop EDC for a given anycast direction */
+uint16_t orpl_hbh_edc(uint8_t direction);
+/* The size of our current forwarder set, set by orpl_calculate_edc */
+extern int forwarder_set_size;
+/* Returns an estimate of the EDC for routing downwards, from us to a node of EDC dest_edc */
+rpl_rank_t orpl_downward_edc(rpl_rank_t dest_edc);
+/* Called after a transmission that was not acked by any neighbor */
+void orpl_noack_callback();
 
 #endif /* __ORPL_H__ */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Interface of radio drivers that send software ACKs with a custom
+ *         payload, as needed by ORPL's extended ACKs. Drivers call the input
+ *         callback for every incoming frame to decide whether and how to
+ *         ack it, and the acked callback once the ACK was sent.
+ * \author
+ *         Simon Duquennoy <simonduq@sics.se>
+ */
+
+#ifndef __SOFTACK_H__
+#define __SOFTACK_H__
+
+#include "contiki.h"
+
+/* Called upon reception of a frame header, typically from interrupt. Sets *acklen
+ * to the length of the ACK to send and *ackbufptr to its content, or *acklen to 0 */
+typedef void(softack_input_callback_f)(const uint8_t *frame, uint8_t framelen, uint8_t **ackbufptr, uint8_t *acklen);
+/* Called after a complete, valid frame was acked */
+typedef void(softack_acked_callback_f)(const uint8_t *frame, uint8_t framelen);
+
+struct softack_driver {
+  /* Subscribe with two callbacks called upon frame reception */
+  void (* subscribe)(softack_input_callback_f *input_callback, softack_acked_callback_f *acked_callback);
+  /* Prepare a frame for transmission like radio_driver.prepare, from a
+   * header and a payload that need not be contiguous (hdr may be NULL),
+   * padding it with zeroes up to padded_len while writing it to the radio */
+  int (* prepare_padded)(const void *hdr, unsigned short hdr_len,
+                         const void *payload, unsigned short payload_len,
+                         unsigned short padded_len);
+};
+
+/* The softack driver must match NETSTACK_CONF_RADIO */
+#ifdef SOFTACK_CONF_DRIVER
+#define SOFTACK_DRIVER SOFTACK_CONF_DRIVER
+#else /* SOFTACK_CONF_DRIVER */
+#define SOFTACK_DRIVER cc2420_softack
+#endif /* SOFTACK_CONF_DRIVER */
+
+extern const struct softack_driver SOFTACK_DRIVER;
+
+#endif /* __SOFTACK_H__ */
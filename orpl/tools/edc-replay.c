@@ -0,0 +1,228 @@
+/* Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Host tool that replays the EDC computation on snapshots dumped by
+ *         orpl-log ("ORPL: edc snapshot <hex>" lines, see orpl_log_edc_snapshot),
+ *         with the ORPL objective function or alternative ones.
+ *
+ *         Build: gcc -I.. -o edc-replay edc-replay.c ../orpl-edc-snapshot.c
+ *         Usage: edc-replay [-v] [-o of] [-w edc_w] < log
+ *
+ * \author Simon Duquennoy <simonduq@sics.se>
+ */
+
+#include "orpl-edc-snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_TAG "edc snapshot "
+#define MAX_LINE_LEN 2048
+
+/* An objective function: computes EDC from a snapshot */
+struct replay_of {
+  const char *name;
+  uint16_t (* calculate)(const struct orpl_edc_snapshot *s, uint8_t *fs_size, int verbose);
+};
+
+/* Alternative objective function: unicast-like, EDC through the single best neighbor */
+static uint16_t
+calculate_single(const struct orpl_edc_snapshot *s, uint8_t *fs_size, int verbose)
+{
+  uint16_t edc = 0xffff;
+  int i;
+
+  for(i = 0; i < s->count; i++) {
+    uint32_t ackcount_sum = 0;
+    uint32_t ackcount_edc_sum = 0;
+    uint16_t tentative_edc;
+    if(s->nbr[i].rank == 0xffff
+        || (s->broadcast_count > 0 && s->nbr[i].ackcount == 0)) {
+      continue;
+    }
+    tentative_edc = orpl_edc_tentative(s->hbh_edc, s->broadcast_count, s->edc_w,
+        s->nbr[i].rank, s->nbr[i].ackcount, &ackcount_sum, &ackcount_edc_sum, 0);
+    if(verbose) {
+      printf("EDC -> node %3u rank: %5u EDC %5u\n", s->nbr[i].id, s->nbr[i].rank, tentative_edc);
+    }
+    if(tentative_edc < edc) {
+      edc = tentative_edc;
+    }
+  }
+  *fs_size = edc != 0xffff ? 1 : 0;
+  return edc;
+}
+
+/* Add alternative objective functions here */
+static const struct replay_of ofs[] = {
+  { "orpl", orpl_edc_snapshot_calculate },
+  { "single", calculate_single },
+};
+#define N_OFS (sizeof(ofs) / sizeof(ofs[0]))
+
+/* Reads n bytes of little-endian hex from *str, advances *str. Returns -1 on error */
+static long
+parse_field(const char **str, int n)
+{
+  unsigned long value = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    unsigned int byte;
+    if(sscanf(*str, "%2x", &byte) != 1) {
+      return -1;
+    }
+    value |= (unsigned long)byte << (8 * i);
+    *str += 2;
+  }
+  return value;
+}
+
+/* Parses a hex snapshot. Returns 0 on success */
+static int
+parse_snapshot(const char *str, struct orpl_edc_snapshot *s)
+{
+  long v[7];
+  static const int lens[7] = { 1, 2, 2, 2, 2, 4, 1 };
+  int i;
+
+  for(i = 0; i < 7; i++) {
+    if((v[i] = parse_field(&str, lens[i])) < 0) {
+      return -1;
+    }
+  }
+  if(v[0] != ORPL_EDC_SNAPSHOT_VERSION || v[6] > ORPL_EDC_SNAPSHOT_MAX_NBR) {
+    return -1;
+  }
+  s->node_id = v[1];
+  s->edc = v[2];
+  s->hbh_edc = v[3];
+  s->edc_w = v[4];
+  s->broadcast_count = v[5];
+  s->count = v[6];
+  for(i = 0; i < s->count; i++) {
+    long id = parse_field(&str, 2);
+    long rank = parse_field(&str, 2);
+    long ackcount = parse_field(&str, 2);
+    if(id < 0 || rank < 0 || ackcount < 0) {
+      return -1;
+    }
+    s->nbr[i].id = id;
+    s->nbr[i].rank = rank;
+    s->nbr[i].ackcount = ackcount;
+  }
+  return 0;
+}
+
+static void
+usage(const char *name)
+{
+  unsigned int i;
+  fprintf(stderr, "Usage: %s [-v] [-o of] [-w edc_w] < log\n", name);
+  fprintf(stderr, "  -v        verbose trace of the computation\n");
+  fprintf(stderr, "  -o of     objective function (default: all):");
+  for(i = 0; i < N_OFS; i++) {
+    fprintf(stderr, " %s", ofs[i].name);
+  }
+  fprintf(stderr, "\n  -w edc_w  replay with another EDC_W than the recorded one\n");
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  char line[MAX_LINE_LEN];
+  const char *of_name = NULL;
+  long edc_w = -1;
+  int verbose = 0;
+  int opt;
+  unsigned int i;
+
+  while((opt = getopt(argc, argv, "vo:w:")) != -1) {
+    switch(opt) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 'o':
+      of_name = optarg;
+      break;
+    case 'w':
+      edc_w = atol(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  printf("node  edc");
+  for(i = 0; i < N_OFS; i++) {
+    if(of_name == NULL || !strcmp(of_name, ofs[i].name)) {
+      printf(" %8s fs", ofs[i].name);
+    }
+  }
+  printf("\n");
+
+  while(fgets(line, sizeof(line), stdin) != NULL) {
+    struct orpl_edc_snapshot s;
+    uint16_t edc[N_OFS];
+    uint8_t fs_size[N_OFS];
+    const char *hex = strstr(line, SNAPSHOT_TAG);
+    if(hex == NULL) {
+      continue;
+    }
+    if(parse_snapshot(hex + strlen(SNAPSHOT_TAG), &s) != 0) {
+      fprintf(stderr, "Skipping malformed snapshot: %s", line);
+      continue;
+    }
+    if(edc_w >= 0) {
+      s.edc_w = edc_w;
+    }
+    for(i = 0; i < N_OFS; i++) {
+      if(of_name == NULL || !strcmp(of_name, ofs[i].name)) {
+        if(verbose) {
+          printf("-- node %u, %s\n", s.node_id, ofs[i].name);
+        }
+        edc[i] = ofs[i].calculate(&s, &fs_size[i], verbose);
+      }
+    }
+    printf("%4u %5u", s.node_id, s.edc);
+    for(i = 0; i < N_OFS; i++) {
+      if(of_name == NULL || !strcmp(of_name, ofs[i].name)) {
+        printf(" %8u %2u", edc[i], fs_size[i]);
+      }
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
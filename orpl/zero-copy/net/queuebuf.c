@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Buffer management functions for queued packets, with reference
+ *         counting. Replaces Contiki's queuebuf.c in builds with
+ *         WITH_ZERO_COPY=1. RAM-only: no swapping to CFS, which the ORPL
+ *         platforms do not use, and no refbuf.
+ *
+ *         Unlike Contiki's, a queuebuf is always a copy: a packetbuf that
+ *         references external data is copied as well. The data referenced
+ *         by a packetbuf may be a queuebuf about to be freed
+ *         (queuebuf_reference_to_packetbuf), e.g. when csma queues a
+ *         packet again from its sent callback.
+ * \author
+ *         Adam Dunkels <adam@sics.se>
+ *         Simon Duquennoy <simonduq@sics.se>
+ */
+
+#include "contiki-net.h"
+#include "net/queuebuf.h"
+#include "lib/memb.h"
+
+#include <string.h>
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+struct queuebuf {
+  uint8_t refcount;
+  uint16_t len;
+  uint8_t data[PACKETBUF_SIZE];
+  struct packetbuf_attr attrs[PACKETBUF_NUM_ATTRS];
+  struct packetbuf_addr addrs[PACKETBUF_NUM_ADDRS];
+};
+
+MEMB(bufmem, struct queuebuf, QUEUEBUF_NUM);
+
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_init(void)
+{
+  memb_init(&bufmem);
+}
+/*---------------------------------------------------------------------------*/
+struct queuebuf *
+queuebuf_new_from_packetbuf(void)
+{
+  struct queuebuf *buf;
+
+  buf = memb_alloc(&bufmem);
+  if(buf == NULL) {
+    PRINTF("queuebuf_new_from_packetbuf: could not allocate a queuebuf\n");
+    return NULL;
+  }
+  buf->refcount = 1;
+  /* packetbuf_copyto follows references */
+  buf->len = packetbuf_copyto(buf->data);
+  packetbuf_attr_copyto(buf->attrs, buf->addrs);
+  return buf;
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_update_attr_from_packetbuf(struct queuebuf *buf)
+{
+  packetbuf_attr_copyto(buf->attrs, buf->addrs);
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_to_packetbuf(struct queuebuf *buf)
+{
+  if(buf != NULL) {
+    packetbuf_copyfrom(buf->data, buf->len);
+    packetbuf_attr_copyfrom(buf->attrs, buf->addrs);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_reference_to_packetbuf(struct queuebuf *buf)
+{
+  if(buf != NULL) {
+    packetbuf_reference(buf->data, buf->len);
+    packetbuf_attr_copyfrom(buf->attrs, buf->addrs);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_ref(struct queuebuf *buf)
+{
+  if(buf != NULL) {
+    buf->refcount++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_free(struct queuebuf *buf)
+{
+  if(buf != NULL && --buf->refcount == 0) {
+    memb_free(&bufmem, buf);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void *
+queuebuf_dataptr(struct queuebuf *buf)
+{
+  return buf->data;
+}
+/*---------------------------------------------------------------------------*/
+int
+queuebuf_datalen(struct queuebuf *buf)
+{
+  return buf->len;
+}
+/*---------------------------------------------------------------------------*/
+rimeaddr_t *
+queuebuf_addr(struct queuebuf *buf, uint8_t type)
+{
+  return &buf->addrs[type - PACKETBUF_ADDR_FIRST].addr;
+}
+/*---------------------------------------------------------------------------*/
+packetbuf_attr_t
+queuebuf_attr(struct queuebuf *buf, uint8_t type)
+{
+  return buf->attrs[type].val;
+}
+/*---------------------------------------------------------------------------*/
+void
+queuebuf_debug_print(void)
+{
+#if DEBUG
+  int i;
+  printf("queuebuf:");
+  for(i = 0; i < QUEUEBUF_NUM; i++) {
+    struct queuebuf *buf = &((struct queuebuf *)bufmem.mem)[i];
+    if(bufmem.count[i] != 0) {
+      printf(" %d:%u:%u", i, buf->refcount, buf->len);
+    }
+  }
+  printf("\n");
+#endif /* DEBUG */
+}
+/*---------------------------------------------------------------------------*/
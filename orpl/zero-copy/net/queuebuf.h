@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2013, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Header file for the queuebuf, overriding Contiki's to add
+ *         reference counting and zero-copy transmission. Built only
+ *         with WITH_ZERO_COPY=1, see Makefile.orpl.
+ * \author
+ *         Adam Dunkels <adam@sics.se>
+ *         Simon Duquennoy <simonduq@sics.se>
+ */
+
+#ifndef __QUEUEBUF_H__
+#define __QUEUEBUF_H__
+
+#include "net/packetbuf.h"
+
+#ifdef QUEUEBUF_CONF_NUM
+#define QUEUEBUF_NUM QUEUEBUF_CONF_NUM
+#else
+#define QUEUEBUF_NUM 8
+#endif
+
+/* Tells ORPL that queuebufs are reference counted */
+#define QUEUEBUF_WITH_REFCOUNT 1
+
+struct queuebuf;
+
+void queuebuf_init(void);
+
+struct queuebuf *queuebuf_new_from_packetbuf(void);
+void queuebuf_update_attr_from_packetbuf(struct queuebuf *b);
+
+void queuebuf_to_packetbuf(struct queuebuf *b);
+/* Like queuebuf_to_packetbuf, but the packetbuf references the queuebuf
+ * data instead of copying it. Only the header is then in packetbuf, the
+ * caller must hold a reference (queuebuf_ref) for as long as the packetbuf
+ * is in use. */
+void queuebuf_reference_to_packetbuf(struct queuebuf *b);
+
+/* Take an extra reference. queuebuf_free drops a reference and frees
+ * the queuebuf only when the last one is dropped. */
+void queuebuf_ref(struct queuebuf *b);
+void queuebuf_free(struct queuebuf *b);
+
+void *queuebuf_dataptr(struct queuebuf *b);
+int queuebuf_datalen(struct queuebuf *b);
+
+rimeaddr_t *queuebuf_addr(struct queuebuf *b, uint8_t type);
+packetbuf_attr_t queuebuf_attr(struct queuebuf *b, uint8_t type);
+
+void queuebuf_debug_print(void);
+
+#endif /* __QUEUEBUF_H__ */